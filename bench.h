@@ -0,0 +1,95 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+/* before v.h: its log macro breaks the declarations in math.h */
+#include <math.h>
+
+#include "v.h"
+
+/*
+	random streams and key distributions shared by the demos and benchmarks.
+	every stream is an xorshift64 seeded with rng_seed(index), so runs repeat
+	exactly and each thread draws its own sequence. include this header
+	first, and link with -lm for the zipf tables.
+*/
+
+#define RNG_SEED 0x9e3779b97f4a7c15ULL
+
+/* never 0, which xorshift64 would get stuck on */
+uint64_t
+rng_seed(size_t index)
+{
+	return RNG_SEED + index;
+}
+
+uint64_t
+xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* uniform in [0, 1) from the top 53 bits */
+double
+rng_unit(uint64_t *state)
+{
+	return (double)(xorshift64(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* zipf ranks 0..count-1, rank 0 the hottest, drawn by inverting the cdf */
+typedef struct {
+	double *cdf;
+	size_t count;
+} Zipf;
+
+/* cdf is caller memory for count doubles */
+Zipf
+zipf_init(double *cdf, size_t count, double skew)
+{
+	Zipf zipf;
+	double sum = 0;
+	size_t i;
+
+	assert(count);
+	for (i = 0; i < count; ++i)
+	{
+		sum += 1.0 / pow((double)(i + 1), skew);
+		cdf[i] = sum;
+	}
+	for (i = 0; i < count; ++i)
+	{
+		cdf[i] /= sum;
+	}
+
+	zipf.cdf = cdf;
+	zipf.count = count;
+
+	return zipf;
+}
+
+size_t
+zipf_next(Zipf *zipf, uint64_t *rng)
+{
+	double u = rng_unit(rng);
+	size_t lo = 0, hi = zipf->count - 1, mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (zipf->cdf[mid] < u)
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+#endif /* BENCH_H */
@@ -1,16 +1,17 @@
 #include "v.h"
 
-#define BUFF_SZ 10 * 1024 * 1024
-static char buff[BUFF_SZ];
+/* address space only, pages are committed as the arena fills */
+#define ARENA_RESERVE ((size_t)1024 * 1024 * 1024)
 
 int main(int argc, char *argv[]) {
 	if (argc < 3) {
 		printf("usage: %s [file] [tabwidth]\n", argv[0]);
 		return 1;
 	}
-	Arena arena = arena_init(buff, BUFF_SZ);
+	Arena arena = arena_reserve(ARENA_RESERVE, 0);
 	int tabwidth = atoi(argv[2]);
 	format_tabs_over_spaces(argv[1], argv[1], 0x100, tabwidth, &arena);
+	arena_release(&arena);
 	return 0;
 }
 
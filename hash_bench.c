@@ -0,0 +1,75 @@
+#include "v.h"
+
+/* hashes keys of each length back to back and reports throughput */
+
+typedef uint64_t (*BenchHashFn)(const void *key, size_t len, uint64_t seed);
+
+typedef struct {
+	const char *name;
+	BenchHashFn fn;
+} BenchHash;
+
+#define DATA_SIZE (1 << 20)
+static unsigned char data[DATA_SIZE];
+
+#define BYTES_PER_RUN (256ULL * 1024 * 1024)
+#define MIN_HASHES_PER_RUN 4000000ULL
+
+static size_t key_lengths[] = {3, 4, 8, 12, 16, 24, 32, 64, 128, 256, 1024, 4096, 65536};
+
+int
+main(void)
+{
+	BenchHash hashes[] = {
+		{"fnv1a", hash_fnv1a},
+		{"wy", hash_wy},
+		{HASH_HAS_AES ? "aes" : "aes(wy fallback)", hash_aes},
+	};
+	size_t h, l, len, n, i, offset_mask;
+	uint64_t seed, sink = 0, start, elapsed;
+
+	seed = 0x9e3779b97f4a7c15ULL;
+	for (i = 0; i < DATA_SIZE; ++i)
+	{
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		data[i] = (unsigned char)(seed >> 56);
+	}
+
+	hash_seed_random();
+
+	printf("%-18s %8s %12s %10s\n", "hash", "len", "ns/hash", "GB/s");
+
+	for (h = 0; h < sizeof(hashes) / sizeof(hashes[0]); ++h)
+	{
+		for (l = 0; l < sizeof(key_lengths) / sizeof(key_lengths[0]); ++l)
+		{
+			len = key_lengths[l];
+			n = BYTES_PER_RUN / len;
+			if (n < MIN_HASHES_PER_RUN && len <= 64)
+			{
+				n = MIN_HASHES_PER_RUN;
+			}
+
+			/* slide the key through the data so consecutive hashes see different bytes */
+			offset_mask = (DATA_SIZE - len) >= 4096 ? 4095 : 0;
+
+			start = time_now_ns();
+			for (i = 0; i < n; ++i)
+			{
+				sink += hashes[h].fn(&data[(i * 7) & offset_mask], len, hash_seed);
+			}
+			elapsed = time_now_ns() - start;
+
+			printf("%-18s %8zu %12.2f %10.2f\n",
+				hashes[h].name,
+				len,
+				(double)elapsed / (double)n,
+				(double)n * (double)len / (double)elapsed);
+		}
+	}
+
+	/* keeps the hashing loops alive */
+	fprintf(stderr, "sink %llx\n", (unsigned long long)sink);
+
+	return 0;
+}
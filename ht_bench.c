@@ -0,0 +1,534 @@
+#include "bench.h"
+#include "ht_bucket.h"
+#include "ht_linear.h"
+
+/*
+	latency, throughput and footprint of HashTable (ht_bucket.h) and
+	LinearHashTable (ht_linear.h) under configurable workloads.
+
+	usage: ht_bench [-t bucket|linear] [-n keys] [-o ops] [-k key_len]
+	                [-d uniform|zipf] [-s zipf_skew] [-r read%] [-h hit%]
+	                [-b bucket_buffer_mb]
+
+	-t, -k, -d, -r and -h each pin one dimension of the run matrix, the ones
+	left out sweep their defaults. every (table, key_len) first runs an insert
+	phase loading the keys, then one mixed phase per (dist, read%, hit%) over
+	the loaded table. reads are gets, writes on hit keys overwrite the value,
+	writes on miss keys insert and remove it again so the size and the hit
+	ratio stay fixed.
+
+	prints one csv row per phase on stdout. ns_per_op comes from an untimed
+	pass over the ops, the percentiles from a second pass timing every op, so
+	they include the cost of one time_now_ns call. peak_bytes is the arena
+	high water mark for HashTable and the slot arrays (old and new ones while
+	rehashing) for LinearHashTable.
+*/
+
+#define DEFAULT_KEY_COUNT (1 << 20)
+#define DEFAULT_OP_COUNT (1 << 20)
+#define DEFAULT_ZIPF_SKEW 0.99
+#define DEFAULT_BUFFER_MB 256
+
+#define INITIAL_BUCKET_COUNT 1024
+#define BUCKET_MAX_CAPACITY 48
+#define BUCKET_INITIAL_CAPACITY 4
+#define LINEAR_INITIAL_SIZE 16
+
+typedef enum {
+	TABLE_BUCKET,
+	TABLE_LINEAR,
+	TABLE_COUNT,
+} TableKind;
+
+typedef enum {
+	DIST_UNIFORM,
+	DIST_ZIPF,
+	DIST_COUNT,
+} KeyDist;
+
+static const char *table_names[] = {"bucket", "linear"};
+static const char *dist_names[] = {"uniform", "zipf"};
+
+static size_t default_key_lengths[] = {8, 16, 32};
+static unsigned default_read_percents[] = {100, 90, 50};
+static unsigned default_hit_percents[] = {100, 50};
+
+typedef struct {
+	TableKind kind;
+	HashTable bucket;
+	LinearHashTable linear;
+	size_t linear_peak_bytes;
+} BenchTable;
+
+typedef struct {
+	uint32_t key;
+	unsigned char write;
+	unsigned char miss;
+} BenchOp;
+
+static struct {
+	size_t key_count;
+	size_t op_count;
+	size_t key_len;
+	double zipf_skew;
+
+	char *bucket_buffer;
+	size_t bucket_buffer_size;
+
+	/* key_count present then key_count absent keys, key_len bytes each */
+	char *key_bytes;
+	Zipf zipf;
+	uint32_t *zipf_rank_to_key;
+
+	BenchOp *ops;
+	uint64_t *latencies;
+	uint64_t rng;
+} bench;
+
+static void *
+bench_alloc(size_t size)
+{
+	void *ptr = malloc(size);
+
+	if (ptr == NULL)
+	{
+		fprintf(stderr, "out of memory allocating %zu bytes\n", size);
+		exit(1);
+	}
+
+	return ptr;
+}
+
+static String8
+bench_key(size_t index, int miss)
+{
+	String8 key;
+
+	key.ptr = bench.key_bytes + ((miss ? bench.key_count : 0) + index) * bench.key_len;
+	key.len = bench.key_len;
+
+	return key;
+}
+
+static void
+bench_keys_generate(void)
+{
+	char tmp[64];
+	size_t i;
+	int miss, len;
+
+	for (miss = 0; miss < 2; ++miss)
+	{
+		for (i = 0; i < bench.key_count; ++i)
+		{
+			len = snprintf(tmp, sizeof(tmp), "%c%0*zu", miss ? 'm' : 'k', (int)bench.key_len - 1, i);
+			if ((size_t)len != bench.key_len)
+			{
+				fprintf(stderr, "%zu keys do not fit in key_len %zu\n", bench.key_count, bench.key_len);
+				exit(1);
+			}
+			memcpy(bench_key(i, miss).ptr, tmp, bench.key_len);
+		}
+	}
+}
+
+/* the hottest ranks land on random keys so they do not share buckets */
+static void
+bench_zipf_init(void)
+{
+	uint64_t r;
+	uint32_t tmp;
+	size_t i, j;
+
+	bench.zipf = zipf_init(bench_alloc(bench.key_count * sizeof(double)), bench.key_count, bench.zipf_skew);
+	for (i = 0; i < bench.key_count; ++i)
+	{
+		bench.zipf_rank_to_key[i] = (uint32_t)i;
+	}
+
+	for (i = bench.key_count - 1; i > 0; --i)
+	{
+		r = xorshift64(&bench.rng);
+		j = r % (i + 1);
+		tmp = bench.zipf_rank_to_key[i];
+		bench.zipf_rank_to_key[i] = bench.zipf_rank_to_key[j];
+		bench.zipf_rank_to_key[j] = tmp;
+	}
+}
+
+static uint32_t
+bench_zipf_next(void)
+{
+	return bench.zipf_rank_to_key[zipf_next(&bench.zipf, &bench.rng)];
+}
+
+static void
+bench_ops_generate(KeyDist dist, unsigned read_percent, unsigned hit_percent)
+{
+	BenchOp *op;
+	uint64_t r;
+	size_t i;
+
+	for (i = 0; i < bench.op_count; ++i)
+	{
+		op = &bench.ops[i];
+		op->key = dist == DIST_ZIPF ?
+			bench_zipf_next() :
+			(uint32_t)((xorshift64(&bench.rng) >> 8) % bench.key_count);
+
+		r = xorshift64(&bench.rng);
+		op->write = r % 100 >= read_percent;
+		op->miss = (r >> 32) % 100 >= hit_percent;
+	}
+}
+
+static void
+bench_table_create(BenchTable *table, TableKind kind)
+{
+	memset(table, 0, sizeof(*table));
+	table->kind = kind;
+
+	if (kind == TABLE_BUCKET)
+	{
+		table->bucket = HashTable_Create(INITIAL_BUCKET_COUNT,
+						Wy_Hash,
+						bench.key_len,
+						sizeof(uint64_t),
+						bench.bucket_buffer, bench.bucket_buffer_size,
+						BUCKET_MAX_CAPACITY,
+						BUCKET_INITIAL_CAPACITY);
+	}
+	else
+	{
+		table->linear = ht_create(bench.key_len, sizeof(uint64_t), LINEAR_INITIAL_SIZE, wyhash);
+		table->linear_peak_bytes = ht_bytes(&table->linear);
+	}
+}
+
+static void
+bench_table_destroy(BenchTable *table)
+{
+	if (table->kind == TABLE_LINEAR)
+	{
+		ht_destroy(&table->linear);
+	}
+}
+
+static void
+bench_table_set(BenchTable *table, String8 key, uint64_t *value)
+{
+	size_t bytes, new_bytes;
+
+	if (table->kind == TABLE_BUCKET)
+	{
+		if (!HashTable_SetS(&table->bucket, key, value))
+		{
+			fprintf(stderr, "bucket buffer full, raise -b\n");
+			exit(1);
+		}
+	}
+	else
+	{
+		bytes = ht_bytes(&table->linear);
+		ht_set(&table->linear, key.ptr, value);
+		new_bytes = ht_bytes(&table->linear);
+		if (new_bytes != bytes && bytes + new_bytes > table->linear_peak_bytes)
+		{
+			table->linear_peak_bytes = bytes + new_bytes;
+		}
+	}
+}
+
+static int
+bench_table_get(BenchTable *table, String8 key, uint64_t *out_value)
+{
+	uint64_t *value;
+
+	if (table->kind == TABLE_BUCKET)
+	{
+		return HashTable_GetS(&table->bucket, key, out_value);
+	}
+
+	value = ht_get(&table->linear, key.ptr);
+	if (value)
+	{
+		*out_value = *value;
+	}
+	return value != NULL;
+}
+
+static int
+bench_table_remove(BenchTable *table, String8 key)
+{
+	if (table->kind == TABLE_BUCKET)
+	{
+		return HashTable_RemoveS(&table->bucket, key);
+	}
+	return ht_remove(&table->linear, key.ptr);
+}
+
+static size_t
+bench_table_size(BenchTable *table)
+{
+	return table->kind == TABLE_BUCKET ? table->bucket.size : table->linear.size;
+}
+
+static size_t
+bench_table_peak_bytes(BenchTable *table)
+{
+	return table->kind == TABLE_BUCKET ? table->bucket.arena.current_offset : table->linear_peak_bytes;
+}
+
+static uint64_t sink;
+
+static void
+bench_op_run(BenchTable *table, BenchOp *op)
+{
+	String8 key = bench_key(op->key, op->miss);
+	uint64_t value;
+
+	if (!op->write)
+	{
+		value = 0;
+		bench_table_get(table, key, &value);
+		sink += value;
+	}
+	else
+	{
+		value = op->key;
+		bench_table_set(table, key, &value);
+		if (op->miss)
+		{
+			bench_table_remove(table, key);
+		}
+	}
+}
+
+static int
+u64_compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void
+bench_report(BenchTable *table, const char *phase, size_t op_count,
+		KeyDist dist, unsigned read_percent, unsigned hit_percent,
+		uint64_t elapsed)
+{
+	size_t size = bench_table_size(table), peak_bytes = bench_table_peak_bytes(table);
+
+	qsort(bench.latencies, op_count, sizeof(uint64_t), u64_compare);
+
+	printf("%s,%s,%zu,%zu,%zu,%s,%.2f,%u,%u,%.2f,%llu,%llu,%llu,%zu,%.2f\n",
+		table_names[table->kind],
+		phase,
+		bench.key_count,
+		op_count,
+		bench.key_len,
+		dist_names[dist],
+		dist == DIST_ZIPF ? bench.zipf_skew : 0.0,
+		read_percent,
+		hit_percent,
+		(double)elapsed / (double)op_count,
+		(unsigned long long)bench.latencies[op_count * 50 / 100],
+		(unsigned long long)bench.latencies[op_count * 99 / 100],
+		(unsigned long long)bench.latencies[op_count * 999 / 1000],
+		peak_bytes,
+		size ? (double)peak_bytes / (double)size : 0.0);
+	fflush(stdout);
+}
+
+/* loads every present key, once for throughput and once timing each insert */
+static void
+bench_insert(BenchTable *table, TableKind kind)
+{
+	uint64_t value, start, elapsed;
+	size_t i;
+
+	bench_table_create(table, kind);
+	start = time_now_ns();
+	for (i = 0; i < bench.key_count; ++i)
+	{
+		value = i;
+		bench_table_set(table, bench_key(i, 0), &value);
+	}
+	elapsed = time_now_ns() - start;
+	bench_table_destroy(table);
+
+	bench_table_create(table, kind);
+	for (i = 0; i < bench.key_count; ++i)
+	{
+		value = i;
+		start = time_now_ns();
+		bench_table_set(table, bench_key(i, 0), &value);
+		bench.latencies[i] = time_now_ns() - start;
+	}
+	assert(bench_table_size(table) == bench.key_count);
+
+	bench_report(table, "insert", bench.key_count, DIST_UNIFORM, 0, 100, elapsed);
+}
+
+static void
+bench_mixed(BenchTable *table, KeyDist dist, unsigned read_percent, unsigned hit_percent)
+{
+	uint64_t start, elapsed;
+	size_t i;
+
+	bench_ops_generate(dist, read_percent, hit_percent);
+
+	start = time_now_ns();
+	for (i = 0; i < bench.op_count; ++i)
+	{
+		bench_op_run(table, &bench.ops[i]);
+	}
+	elapsed = time_now_ns() - start;
+
+	for (i = 0; i < bench.op_count; ++i)
+	{
+		start = time_now_ns();
+		bench_op_run(table, &bench.ops[i]);
+		bench.latencies[i] = time_now_ns() - start;
+	}
+	assert(bench_table_size(table) == bench.key_count);
+
+	bench_report(table, "mixed", bench.op_count, dist, read_percent, hit_percent, elapsed);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+		"usage: ht_bench [-t bucket|linear] [-n keys] [-o ops] [-k key_len]\n"
+		"                [-d uniform|zipf] [-s zipf_skew] [-r read%%] [-h hit%%]\n"
+		"                [-b bucket_buffer_mb]\n");
+	exit(1);
+}
+
+static int
+name_index(const char *name, const char **names, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i)
+	{
+		if (strcmp(name, names[i]) == 0)
+		{
+			return i;
+		}
+	}
+	usage();
+	return -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int table_kind = -1, dist = -1, read_percent = -1, hit_percent = -1;
+	size_t key_len = 0, buffer_mb = DEFAULT_BUFFER_MB, max_key_len, samples;
+	size_t t, k, d, r, h;
+	BenchTable table;
+	char *arg;
+	int i;
+
+	bench.key_count = DEFAULT_KEY_COUNT;
+	bench.op_count = DEFAULT_OP_COUNT;
+	bench.zipf_skew = DEFAULT_ZIPF_SKEW;
+	bench.rng = rng_seed(0);
+
+	for (i = 1; i < argc; i += 2)
+	{
+		if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+		{
+			usage();
+		}
+		arg = argv[i + 1];
+
+		switch (argv[i][1])
+		{
+			case 't': table_kind = name_index(arg, table_names, TABLE_COUNT); break;
+			case 'd': dist = name_index(arg, dist_names, DIST_COUNT); break;
+			case 'n': bench.key_count = strtoull(arg, NULL, 10); break;
+			case 'o': bench.op_count = strtoull(arg, NULL, 10); break;
+			case 'k': key_len = strtoull(arg, NULL, 10); break;
+			case 's': bench.zipf_skew = strtod(arg, NULL); break;
+			case 'r': read_percent = atoi(arg); break;
+			case 'h': hit_percent = atoi(arg); break;
+			case 'b': buffer_mb = strtoull(arg, NULL, 10); break;
+			default: usage();
+		}
+	}
+
+	if (bench.key_count == 0 || bench.key_count > UINT32_MAX || bench.op_count == 0 ||
+		(key_len && (key_len < 2 || key_len > 48)) ||
+		read_percent > 100 || hit_percent > 100 || buffer_mb == 0)
+	{
+		usage();
+	}
+
+	max_key_len = key_len;
+	for (k = 0; k < sizeof(default_key_lengths) / sizeof(default_key_lengths[0]); ++k)
+	{
+		if (!key_len && default_key_lengths[k] > max_key_len)
+		{
+			max_key_len = default_key_lengths[k];
+		}
+	}
+
+	samples = bench.key_count > bench.op_count ? bench.key_count : bench.op_count;
+	bench.key_bytes = bench_alloc(2 * bench.key_count * max_key_len);
+	bench.ops = bench_alloc(bench.op_count * sizeof(BenchOp));
+	bench.latencies = bench_alloc(samples * sizeof(uint64_t));
+	bench.bucket_buffer_size = buffer_mb * 1024 * 1024;
+	bench.bucket_buffer = bench_alloc(bench.bucket_buffer_size);
+
+	if (dist != DIST_UNIFORM)
+	{
+		bench.zipf_rank_to_key = bench_alloc(bench.key_count * sizeof(uint32_t));
+		bench_zipf_init();
+	}
+
+	printf("table,phase,keys,ops,key_len,dist,zipf_skew,read_pct,hit_pct,"
+		"ns_per_op,p50_ns,p99_ns,p999_ns,peak_bytes,bytes_per_entry\n");
+
+	for (k = 0; k < sizeof(default_key_lengths) / sizeof(default_key_lengths[0]); ++k)
+	{
+		bench.key_len = key_len ? key_len : default_key_lengths[k];
+		bench_keys_generate();
+
+		for (t = 0; t < TABLE_COUNT; ++t)
+		{
+			if (table_kind >= 0 && (int)t != table_kind) continue;
+
+			bench_insert(&table, (TableKind)t);
+
+			for (d = 0; d < DIST_COUNT; ++d)
+			{
+				if (dist >= 0 && (int)d != dist) continue;
+
+				for (r = 0; r < sizeof(default_read_percents) / sizeof(default_read_percents[0]); ++r)
+				{
+					if (read_percent >= 0 && r > 0) break;
+
+					for (h = 0; h < sizeof(default_hit_percents) / sizeof(default_hit_percents[0]); ++h)
+					{
+						if (hit_percent >= 0 && h > 0) break;
+
+						bench_mixed(&table, (KeyDist)d,
+							read_percent >= 0 ? (unsigned)read_percent : default_read_percents[r],
+							hit_percent >= 0 ? (unsigned)hit_percent : default_hit_percents[h]);
+					}
+				}
+			}
+
+			bench_table_destroy(&table);
+		}
+
+		if (key_len) break;
+	}
+
+	/* keeps the lookups alive */
+	fprintf(stderr, "sink %llx\n", (unsigned long long)sink);
+
+	return 0;
+}
@@ -1,278 +1,240 @@
-#include "v.h"
+#include "ht_bucket.h"
 
-static int
-String8Eq(String8 key1, String8 key2) {
-    return (key1.len == key2.len) && 
-           (memcmp(key1.ptr, key2.ptr, key1.len) == 0);
-}
-
-static void *
-nth_no_bounds_checking(void *values, size_t n, size_t value_size)
-{
-	return (char *)values + value_size * n;
-}
-
-typedef struct {
-	Arena arena_keys;
-	Arena arena_keys_ptrs;
-	Arena arena_values;
-	String8 *keys;
-	void *values;
-	size_t size;
-	size_t capacity;
-} HashTable_Bucket;
-
-HashTable_Bucket
-HashTable_Bucket_Create(size_t max_capacity, size_t initial_capacity, size_t max_key_length, size_t value_size, Arena *arena)
-{
-	HashTable_Bucket bucket;
-	char *arena_keys_buff, *arena_keys_ptrs_buff, *arena_values_buff;
-	Arena arena_keys, arena_keys_ptrs, arena_values;
-	String8 *keys;
-	void *values;
-
-	arena_keys_buff = arena_alloc(arena, max_capacity * sizeof(String8));
-	assert(arena_keys_buff);
-	arena_keys = arena_init(arena_keys_buff, max_capacity * sizeof(String8));
-
-	arena_keys_ptrs_buff = arena_alloc(arena, max_capacity * max_key_length);
-	assert(arena_keys_ptrs_buff);
-	arena_keys_ptrs = arena_init(arena_keys_ptrs_buff, max_capacity * max_key_length);
-
-	arena_values_buff = arena_alloc(arena, max_capacity * value_size);
-	assert(arena_values_buff);
-	arena_values = arena_init(arena_values_buff, max_capacity * value_size);
-
-	keys = arena_alloc(&arena_keys, initial_capacity * sizeof(String8));
-	assert(keys);
-
-	values = arena_alloc(&arena_values, initial_capacity * value_size);
-	assert(values);
-
-	memset(&bucket, 0, sizeof(bucket));
-	bucket.arena_keys = arena_keys;
-	bucket.arena_keys_ptrs = arena_keys_ptrs;
-	bucket.arena_values = arena_values;
-	bucket.keys = keys;
-	bucket.values = values;
-	bucket.capacity = initial_capacity;
-
-	return bucket;
-}
-
-static size_t
-HashTable_Bucket_Add(HashTable_Bucket *bucket, String8 key, void *value, size_t value_size)
-{
-	size_t i;
-	String8 *keys;
-	void *values;
-	char *key_ptr;
+/* address space only, the table commits what it uses */
+#define RESERVE_SIZE ((size_t)1024 * 1024 * 1024)
 
-	for (i = 0; i < bucket->size; ++i)
-	{
-		if (String8Eq(bucket->keys[i], key))
-		{
-			memcpy(nth_no_bounds_checking(bucket->values, i, value_size),
-				value,
-				value_size);
-			return i;
-		}
-	}
-
-	if (bucket->size == bucket->capacity)
-	{
-		bucket->capacity *= 2;
+#define INITIAL_BUCKET_COUNT 1024
+#define MAX_KEY_LENGTH 8
+#define BUCKET_MAX_CAPACITY 48
+#define BUCKET_INITIAL_CAPACITY 4
 
-		keys = arena_resize_last(&bucket->arena_keys, bucket->capacity * sizeof(String8));
-		assert(keys);
+#define BATCH_SIZE 200
 
-		values = arena_resize_last(&bucket->arena_values, bucket->capacity * value_size);
-		assert(values);
-
-		bucket->keys = keys;
-		bucket->values = values;
-	}
-
-	key_ptr = arena_alloc(&bucket->arena_keys_ptrs, key.len);
-	assert(key_ptr);
-	memcpy(key_ptr, key.ptr, key.len);
-
-	key.ptr = key_ptr;
-	memcpy(&bucket->keys[bucket->size], &key, sizeof(key));
+typedef struct {
+	float x;
+	float y;
+} Point;
 
-	memcpy(nth_no_bounds_checking(bucket->values, bucket->size, value_size),
-		value,
-		value_size);
+static char batch_key_buffer[BATCH_SIZE][10];
+static String8 batch_keys[BATCH_SIZE];
+static Point batch_points[BATCH_SIZE];
 
-	return bucket->size++;
-}
+/*
+	keys starting with 'c' all hash to COLLIDE_HASH, keys starting with 's'
+	share its bucket among 128 but split by their last digit among 256, the
+	rest spread out but never land in its bucket: bucket counts stay powers
+	of two from 128 up
+*/
+#define COLLIDE_HASH 100
 
 static size_t
-HashTable_Bucket_Search(HashTable_Bucket *bucket, String8 search_key)
+Collide_Hash(String8 key)
 {
-	size_t i;
-	String8 current_key;
+	size_t hash;
 
-	for (i = 0; i < bucket->size; ++i)
+	if (key.len && key.ptr[0] == 'c')
 	{
-		current_key = bucket->keys[i];
-		if (String8Eq(current_key, search_key))
-		{
-			return i;
-		}
+		return COLLIDE_HASH;
+	}
+	if (key.len && key.ptr[0] == 's')
+	{
+		return COLLIDE_HASH + 128 * (size_t)(key.ptr[key.len - 1] & 1);
 	}
 
-	return bucket->size;
+	hash = Wy_Hash(key);
+	return (hash & 127) == COLLIDE_HASH ? hash ^ 1 : hash;
 }
 
-typedef size_t (*HashFn)(String8 key);
-
-typedef struct {
-	Arena arena;
-	size_t bucket_initial_capacity;
-	HashFn hash_fn;
-	size_t max_key_length;
-	size_t value_size;
-
-	struct {
-		HashTable_Bucket *ptr;
-		size_t size;
-		size_t capacity;
-	} buckets;
-} HashTable;
-
-HashTable
-HashTable_Create(size_t initial_bucket_count,
-		HashFn hash_fn,
-		size_t max_key_length, 
-		size_t value_size,
-		char *buffer, size_t buffer_size,
-		size_t bucket_max_capacity,
-		size_t bucket_initial_capacity)
+/*
+	a bucket filled before a grow, then inserted into directly while its
+	entries are still waiting to move: the move must neither overflow the
+	bucket nor drop entries
+*/
+static void
+collide_during_rehash(void)
 {
 	HashTable hash_table;
-	Arena arena;
+	char key[24];
+	size_t i, set = 0, fillers = 0;
+	uint64_t value;
 
-	memset(&hash_table, 0, sizeof(hash_table));
-	arena = arena_init(buffer, buffer_size);
+	hash_table = HashTable_Create(128, Collide_Hash, 15, sizeof(uint64_t), NULL, RESERVE_SIZE, BUCKET_MAX_CAPACITY, BUCKET_INITIAL_CAPACITY);
 
-	hash_table.arena = arena;
-	hash_table.bucket_initial_capacity = bucket_initial_capacity;
-	hash_table.hash_fn = hash_fn;
-	hash_table.max_key_length = max_key_length;
-	hash_table.value_size = value_size;
-	
-	HashTable_Bucket *buckets = arena_alloc(&arena, sizeof(HashTable_Bucket) * initial_bucket_count);
-	assert(buckets);
-	hash_table.buckets.ptr = buckets;
-	hash_table.buckets.capacity = initial_bucket_count;
-	while (hash_table.buckets.size < initial_bucket_count)
+	for (i = 0; i < 40; ++i)
 	{
-		hash_table.buckets.ptr[hash_table.buckets.size++] = HashTable_Bucket_Create(bucket_max_capacity,
-												bucket_initial_capacity,
-												max_key_length,
-												value_size,
-												&arena);
+		value = i;
+		snprintf(key, sizeof(key), "c%zu", i);
+		set += HashTable_Set(&hash_table, key, &value);
 	}
+	assert(set == 40);
 
-	return hash_table;
-}
-
-int
-HashTable_Set(HashTable *hash_table, char *key, void *value, Arena *arena)
-{
-	String8 key_str;
-	size_t bucket_id;
-	HashTable_Bucket *bucket;
+	while (!HashTable_Is_Rehashing(&hash_table))
+	{
+		value = fillers;
+		snprintf(key, sizeof(key), "f%zu", fillers++);
+		assert(HashTable_Set(&hash_table, key, &value));
+	}
 
-	key_str = string8_create(key, arena);
-	if (key_str.len > hash_table->max_key_length)
+	/* the keys share their whole hash, no bucket count splits them: only what fits goes in */
+	for (i = 40; i < 50; ++i)
 	{
-		return 0;
+		value = i;
+		snprintf(key, sizeof(key), "c%zu", i);
+		set += HashTable_Set(&hash_table, key, &value);
 	}
+	assert(set == BUCKET_MAX_CAPACITY);
 
-	bucket_id = hash_table->hash_fn(key_str) % hash_table->buckets.size;
-	bucket = &hash_table->buckets.ptr[bucket_id];
+	/* the load factor grew the table once, the full bucket that cannot split did not */
+	assert(hash_table.grows == 1);
+	assert(hash_table.size == set + fillers);
 
-	HashTable_Bucket_Add(bucket, key_str, value, hash_table->value_size);
+	for (i = 0; i < 50; ++i)
+	{
+		snprintf(key, sizeof(key), "c%zu", i);
+		assert(HashTable_Get(&hash_table, key, &value) == (i < set));
+		assert(i >= set || value == i);
+	}
+	for (i = 0; i < fillers; ++i)
+	{
+		snprintf(key, sizeof(key), "f%zu", i);
+		assert(HashTable_Get(&hash_table, key, &value) && value == i);
+	}
 
-	return 1;
+	HashTable_Destroy(&hash_table);
 }
 
-int
-HashTable_Get(HashTable *hash_table, char *key, void *out_value, Arena *arena)
+/* a forced grow moves the full bucket only, not the whole table */
+static void
+split_full_bucket(void)
 {
-	String8 key_str;
-	size_t bucket_id;
-	HashTable_Bucket bucket;
-	size_t elem_id;
+	HashTable hash_table;
+	char key[24];
+	size_t i;
+	uint64_t value;
+
+	hash_table = HashTable_Create(128, Collide_Hash, 15, sizeof(uint64_t), NULL, RESERVE_SIZE, BUCKET_MAX_CAPACITY, BUCKET_INITIAL_CAPACITY);
 
-	key_str = string8_create(key, arena);
-	if (key_str.len > hash_table->max_key_length)
+	for (i = 0; i < 1000; ++i)
+	{
+		value = i;
+		snprintf(key, sizeof(key), "f%zu", i);
+		assert(HashTable_Set(&hash_table, key, &value));
+	}
+	for (i = 0; i <= BUCKET_MAX_CAPACITY; ++i)
 	{
-		return 0;
+		value = i;
+		snprintf(key, sizeof(key), "s%zu", i);
+		assert(HashTable_Set(&hash_table, key, &value));
 	}
 
-	bucket_id = hash_table->hash_fn(key_str) % hash_table->buckets.size;
-	bucket = hash_table->buckets.ptr[bucket_id];
+	/* the insert that found the bucket full grew the table and left the rest to the usual steps */
+	assert(hash_table.grows == 1);
+	assert(HashTable_Is_Rehashing(&hash_table) && hash_table.rehash_index < hash_table.rehash_buckets.size / 2);
 
-	elem_id = HashTable_Bucket_Search(&bucket, key_str);
-	if (elem_id == bucket.size)
+	for (i = 0; i <= BUCKET_MAX_CAPACITY; ++i)
 	{
-		return 0;
+		snprintf(key, sizeof(key), "s%zu", i);
+		assert(HashTable_Get(&hash_table, key, &value) && value == i);
 	}
-	
-	if (out_value)
+	for (i = 0; i < 1000; ++i)
 	{
-		memcpy(out_value,
-			nth_no_bounds_checking(bucket.values, elem_id, hash_table->value_size),
-			hash_table->value_size);
+		snprintf(key, sizeof(key), "f%zu", i);
+		assert(HashTable_Get(&hash_table, key, &value) && value == i);
 	}
+	assert(!HashTable_Is_Rehashing(&hash_table) && hash_table.size == 1000 + BUCKET_MAX_CAPACITY + 1);
 
-	return 1;
+	HashTable_Destroy(&hash_table);
 }
 
-size_t FNV1a_Hash(String8 key) {
-	size_t hash = 0xcbf29ce484222325ULL;  // FNV offset basis
-	for (size_t i = 0; i < key.len; i++) {
-		hash ^= (unsigned char)key.ptr[i];
-		hash *= 0x100000001b3ULL;  // FNV prime
+#define LONG_KEY_COUNT 8192
+
+/*
+	keys too long to sit inline: most of them are removed and put back
+	again and again, the bytes of the removed ones must be compacted away
+	rather than pile up in their buckets
+*/
+static void
+long_keys_churn(void)
+{
+	HashTable hash_table;
+	HashTable_Stats stats;
+	char key[40];
+	size_t i, round;
+	uint64_t value;
+#ifdef HASHTABLE_COUNTERS
+	size_t key_repacks;
+#endif
+
+	hash_table = HashTable_Create(INITIAL_BUCKET_COUNT, Wy_Hash, 32, sizeof(uint64_t), NULL, RESERVE_SIZE, BUCKET_MAX_CAPACITY, BUCKET_INITIAL_CAPACITY);
+
+	for (i = 0; i < LONG_KEY_COUNT; ++i)
+	{
+		value = i;
+		snprintf(key, sizeof(key), "out_of_line_key_%zu", i);
+		assert(strlen(key) > HASHTABLE_INLINE_KEY);
+		assert(HashTable_Set(&hash_table, key, &value));
 	}
-	return hash;
-}
 
-#define TMP_BUFFER_SIZE 0x1000
-static char tmp_buffer[TMP_BUFFER_SIZE];
+	for (round = 1; round <= 4; ++round)
+	{
+#ifdef HASHTABLE_COUNTERS
+		key_repacks = hash_table.counters.key_repacks;
+#endif
+		for (i = 0; i < LONG_KEY_COUNT; ++i)
+		{
+			if (i % 4 != round % 4)
+			{
+				snprintf(key, sizeof(key), "out_of_line_key_%zu", i);
+				assert(HashTable_Remove(&hash_table, key));
+			}
+		}
+#ifdef HASHTABLE_COUNTERS
+		/* removes only repack to compact, never to grow */
+		assert(hash_table.counters.key_repacks > key_repacks);
+#endif
 
-#define BUFFER_SIZE (100 * 1024 * 1024)
-static char buffer[BUFFER_SIZE];
+		stats = HashTable_Stats_Get(&hash_table);
+		assert(stats.key_bytes_dead * 100 <= (stats.key_bytes_used + stats.key_bytes_dead) * HASHTABLE_KEY_WASTE_PERCENT);
 
-#define INITIAL_BUCKET_COUNT 10000
-#define MAX_KEY_LENGTH 20
-#define BUCKET_MAX_CAPACITY 160
-#define BUCKET_INITIAL_CAPACITY 5
+		for (i = 0; i < LONG_KEY_COUNT; ++i)
+		{
+			if (i % 4 != round % 4)
+			{
+				value = i + round * LONG_KEY_COUNT;
+				snprintf(key, sizeof(key), "out_of_line_key_%zu", i);
+				assert(HashTable_Set(&hash_table, key, &value));
+			}
+		}
+	}
 
-typedef struct {
-	float x;
-	float y;
-} Point;
+	/* the table never grew, so only removes and appends touched the key bytes */
+	assert(hash_table.grows == 0 && hash_table.size == LONG_KEY_COUNT);
+	for (i = 0; i < LONG_KEY_COUNT; ++i)
+	{
+		snprintf(key, sizeof(key), "out_of_line_key_%zu", i);
+		assert(HashTable_Get(&hash_table, key, &value));
+		/* the last round that removed it put it back */
+		for (round = 4; i % 4 == round % 4; --round);
+		assert(value == i + round * LONG_KEY_COUNT);
+	}
+
+	HashTable_Destroy(&hash_table);
+}
 
 int
 main(void)
 {
-	Arena tmp_arena;
 	HashTable hash_table;
+	HashTable_Stats stats;
 	Point p;
-	size_t i;
+	size_t i, j;
 	char ps[10];
 
-	tmp_arena = arena_init(tmp_buffer, TMP_BUFFER_SIZE);
-
 	hash_table = HashTable_Create(INITIAL_BUCKET_COUNT,
-					FNV1a_Hash,
+					Wy_Hash,
 					MAX_KEY_LENGTH,
 					sizeof(Point),
-					buffer, BUFFER_SIZE,
+					NULL, RESERVE_SIZE,
 					BUCKET_MAX_CAPACITY,
 					BUCKET_INITIAL_CAPACITY);
 
@@ -280,21 +242,59 @@ main(void)
 	{
 		p.x = p.y = i % 10;
 		sprintf(ps, "p%zu", i);
-		if (tmp_arena.size + MAX_KEY_LENGTH > tmp_arena.capacity) {
-			arena_reset(&tmp_arena);
-		}
-		HashTable_Set(&hash_table, ps, &p, &tmp_arena);
+		HashTable_Set(&hash_table, ps, &p);
 	}
+	assert(hash_table.size == 1000000);
 	
 	for (i = 0; i < 1000000; ++i)
 	{
 		p.x = p.y = i % 10;
 		sprintf(ps, "p%zu", i);
-		if (tmp_arena.size + MAX_KEY_LENGTH > tmp_arena.capacity) {
-			arena_reset(&tmp_arena);
+		assert(HashTable_Get(&hash_table, ps, NULL));
+	}
+
+	for (i = 0; i < 1000000; i += BATCH_SIZE)
+	{
+		for (j = 0; j < BATCH_SIZE; ++j)
+		{
+			batch_keys[j].ptr = batch_key_buffer[j];
+			batch_keys[j].len = sprintf(batch_key_buffer[j], "p%zu", i + j);
 		}
-		assert(HashTable_Get(&hash_table, ps, NULL, &tmp_arena));
+		assert(HashTable_GetBatch(&hash_table, batch_keys, BATCH_SIZE, batch_points, NULL) == BATCH_SIZE);
+		assert(batch_points[BATCH_SIZE - 1].x == (i + BATCH_SIZE - 1) % 10);
+	}
+
+	for (i = 0; i < 1000000; i += 2)
+	{
+		sprintf(ps, "p%zu", i);
+		assert(HashTable_Remove(&hash_table, ps));
+	}
+	assert(hash_table.size == 500000);
+
+	for (i = 0; i < 1000000; ++i)
+	{
+		sprintf(ps, "p%zu", i);
+		assert((size_t)HashTable_Get(&hash_table, ps, NULL) == i % 2);
+	}
+
+	for (i = 0; i < 1000000; i += 2)
+	{
+		p.x = p.y = i % 10;
+		sprintf(ps, "p%zu", i);
+		HashTable_Set(&hash_table, ps, &p);
 	}
+	assert(hash_table.size == 1000000);
+
+	collide_during_rehash();
+	split_full_bucket();
+	long_keys_churn();
+
+	stats = HashTable_Stats_Get(&hash_table);
+	HashTable_Stats_Print(stdout, &stats);
+#ifdef ARENA_DEBUG
+	arena_report(stdout, &hash_table.arena);
+#endif
+	HashTable_Destroy(&hash_table);
 
 	return 0;
 }
@@ -0,0 +1,1305 @@
+#ifndef HT_BUCKET_H
+#define HT_BUCKET_H
+
+#include "v.h"
+
+static int
+String8Eq(String8 key1, String8 key2) {
+    return (key1.len == key2.len) && 
+           (memcmp(key1.ptr, key2.ptr, key1.len) == 0);
+}
+
+static void *
+nth_no_bounds_checking(void *values, size_t n, size_t value_size)
+{
+	return (char *)values + value_size * n;
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define HASHTABLE_SSE2
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+	#include <xmmintrin.h>
+	#define HashTable_Prefetch(ptr) _mm_prefetch((const char *)(ptr), _MM_HINT_T0)
+#else
+	#define HashTable_Prefetch(ptr) __builtin_prefetch(ptr)
+#endif
+
+/*
+	every entry has a 1 byte tag taken from the top bits of its hash (the low
+	bits pick the bucket). searches scan the tags HASHTABLE_TAG_GROUP at a time
+	and only compare keys on a tag match.
+*/
+#define HASHTABLE_TAG_GROUP 16
+#define HashTable_Tag(hash) ((unsigned char)((hash) >> (sizeof(size_t) * 8 - 8)))
+
+static unsigned int
+HashTable_Tags_Match(unsigned char *tags, unsigned char tag)
+{
+#ifdef HASHTABLE_SSE2
+	__m128i group = _mm_loadu_si128((__m128i *)tags);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+	unsigned int mask = 0;
+	int i;
+	for (i = 0; i < HASHTABLE_TAG_GROUP; ++i)
+	{
+		mask |= (unsigned int)(tags[i] == tag) << i;
+	}
+	return mask;
+#endif
+}
+
+static size_t
+HashTable_Mask_Next(unsigned int *mask)
+{
+	size_t i;
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long idx;
+	_BitScanForward(&idx, *mask);
+	i = idx;
+#else
+	i = __builtin_ctz(*mask);
+#endif
+	*mask &= *mask - 1;
+	return i;
+}
+
+/*
+	keys of up to HASHTABLE_INLINE_KEY bytes are stored inside their 16 byte
+	slot, so hits and misses on short keys never leave the entries block.
+	longer keys keep a pointer into the bucket's key_bytes and a 32 bit length
+	in the same bytes, marked by len == HASHTABLE_KEY_OUT_OF_LINE.
+*/
+#define HASHTABLE_INLINE_KEY 15
+#define HASHTABLE_KEY_OUT_OF_LINE 0xff
+
+typedef struct {
+	char bytes[HASHTABLE_INLINE_KEY];
+	unsigned char len;
+} HashTable_Key;
+
+static String8
+HashTable_Key_View(HashTable_Key *slot)
+{
+	String8 view;
+	uint32_t len;
+
+	if (slot->len != HASHTABLE_KEY_OUT_OF_LINE)
+	{
+		view.ptr = slot->bytes;
+		view.len = slot->len;
+		return view;
+	}
+
+	memcpy(&view.ptr, slot->bytes, sizeof(char *));
+	memcpy(&len, slot->bytes + sizeof(char *), sizeof(len));
+	view.len = len;
+
+	return view;
+}
+
+static void
+HashTable_Key_Set_Out_Of_Line(HashTable_Key *slot, char *ptr, size_t len)
+{
+	uint32_t len32 = (uint32_t)len;
+
+	memcpy(slot->bytes, &ptr, sizeof(char *));
+	memcpy(slot->bytes + sizeof(char *), &len32, sizeof(len32));
+	slot->len = HASHTABLE_KEY_OUT_OF_LINE;
+}
+
+static int
+HashTable_Key_Eq(HashTable_Key *slot, String8 key)
+{
+	if (slot->len != HASHTABLE_KEY_OUT_OF_LINE)
+	{
+		return slot->len == key.len && memcmp(slot->bytes, key.ptr, key.len) == 0;
+	}
+
+	return String8Eq(HashTable_Key_View(slot), key);
+}
+
+typedef struct {
+	unsigned char *tags; /* start of the entries block, capacity rounded up to HASHTABLE_TAG_GROUP */
+	HashTable_Key *keys;
+	void *values;
+	char *key_bytes;
+	size_t size;
+	size_t capacity;
+	size_t key_bytes_used;
+	size_t key_bytes_capacity;
+	size_t dead_key_bytes; /* bytes of removed out of line keys still held in key_bytes */
+} HashTable_Bucket;
+
+/* repack a bucket's key bytes once removed keys make up this share of them */
+#ifndef HASHTABLE_KEY_WASTE_PERCENT
+#define HASHTABLE_KEY_WASTE_PERCENT 50
+#endif
+
+typedef size_t (*HashFn)(String8 key);
+
+/* average entries per bucket above which the bucket count doubles */
+#ifndef HASHTABLE_MAX_LOAD_FACTOR
+#define HASHTABLE_MAX_LOAD_FACTOR 16
+#endif
+
+/* old buckets migrated per Set/Get while a rehash is in progress */
+#ifndef HASHTABLE_REHASH_STEP
+#define HASHTABLE_REHASH_STEP 4
+#endif
+
+/*
+	all bucket storage comes from one pool carved out of the table arena:
+	blocks come in size classes of 16, 24, 32, 48, 64, 96... bytes (powers of
+	two and the midpoints between them), with an intrusive free list per class.
+	buckets start empty and grow by swapping their block for a larger one, so
+	memory follows the live entries rather than the worst case.
+
+	freed blocks never merge again. a class with an empty free list carves
+	its block off the front of a free block of a larger class before taking
+	fresh arena bytes, and the rest of that block goes back on the free lists
+	of the classes it holds, so space freed by big blocks (old bucket arrays,
+	shrunk buckets) serves small requests. the other way round does not
+	work: small free blocks never add up to a big one, under churn the arena
+	still grows by what sits on the free lists in classes nobody asks for.
+*/
+#define HASHTABLE_POOL_MIN_BLOCK 16
+#define HASHTABLE_POOL_CLASSES (sizeof(size_t) * 16)
+
+typedef struct HashTable_Pool_Block {
+	struct HashTable_Pool_Block *next;
+} HashTable_Pool_Block;
+
+typedef struct {
+	HashTable_Bucket *ptr;
+	size_t size;
+	size_t capacity;
+} HashTable_BucketArray;
+
+/*
+	hot path counters, compiled in with -DHASHTABLE_COUNTERS. they are plain
+	increments: under HashTable_Concurrent readers share a table and the
+	numbers are only approximate.
+*/
+#ifdef HASHTABLE_COUNTERS
+typedef struct {
+	size_t gets;
+	size_t get_hits;
+	size_t sets;
+	size_t inserts;
+	size_t removes;
+	size_t tag_groups_scanned;
+	size_t key_compares;
+	size_t tag_false_matches; /* tag matched but the key did not */
+	size_t buckets_migrated;
+	size_t forced_grows; /* grows triggered by a full bucket rather than the load factor */
+	size_t bucket_resizes;
+	size_t key_repacks;
+	size_t pool_reuses;
+	size_t pool_splits; /* blocks carved from a free block of a larger class */
+	size_t pool_arena_allocs;
+} HashTable_Counters;
+
+#define HashTable_Count(hash_table, counter, n) ((hash_table)->counters.counter += (n))
+#else
+#define HashTable_Count(hash_table, counter, n) ((void)(hash_table))
+#endif
+
+/*
+	growth is incremental: when the load factor is crossed a bucket array of
+	twice the size becomes `buckets` and the previous one is kept in
+	`rehash_buckets`. every Set/Get then migrates a few old buckets, starting
+	at `rehash_index`, until the old array is drained.
+*/
+typedef struct {
+	Arena arena;
+	HashTable_Pool_Block *free_blocks[HASHTABLE_POOL_CLASSES];
+	size_t bucket_initial_capacity;
+	size_t bucket_max_capacity;
+	HashFn hash_fn;
+	size_t max_key_length;
+	size_t value_size;
+	size_t size;
+
+	HashTable_BucketArray buckets;
+	HashTable_BucketArray rehash_buckets;
+	size_t rehash_index;
+	size_t grows;
+
+#ifdef HASHTABLE_COUNTERS
+	HashTable_Counters counters;
+#endif
+} HashTable;
+
+static size_t
+HashTable_Pool_Class_Size(size_t class)
+{
+	size_t size = (size_t)HASHTABLE_POOL_MIN_BLOCK << (class / 2);
+
+	return class % 2 ? size + size / 2 : size;
+}
+
+static size_t
+HashTable_Pool_Class(size_t size)
+{
+	size_t class = 0;
+
+	while (HashTable_Pool_Class_Size(class) < size)
+	{
+		class += 1;
+	}
+
+	return class;
+}
+
+/* puts size bytes at ptr on the free lists, as the largest blocks that fit, a tail under HASHTABLE_POOL_MIN_BLOCK is lost */
+static void
+HashTable_Pool_Free_Range(HashTable *hash_table, char *ptr, size_t size)
+{
+	size_t class, class_size;
+	HashTable_Pool_Block *block;
+
+	while (size >= HASHTABLE_POOL_MIN_BLOCK)
+	{
+		class = HashTable_Pool_Class(size);
+		class_size = HashTable_Pool_Class_Size(class);
+		if (class_size > size)
+		{
+			class -= 1;
+			class_size = HashTable_Pool_Class_Size(class);
+		}
+
+		block = (HashTable_Pool_Block *)ptr;
+		block->next = hash_table->free_blocks[class];
+		hash_table->free_blocks[class] = block;
+
+		ptr += class_size;
+		size -= class_size;
+	}
+}
+
+/* returns NULL once the table arena is exhausted */
+static void *
+HashTable_Pool_Alloc(HashTable *hash_table, size_t size)
+{
+	size_t class, larger;
+	HashTable_Pool_Block *block;
+
+	if (size == 0)
+	{
+		return NULL;
+	}
+
+	class = HashTable_Pool_Class(size);
+	block = hash_table->free_blocks[class];
+	if (block)
+	{
+		hash_table->free_blocks[class] = block->next;
+		HashTable_Count(hash_table, pool_reuses, 1);
+		return block;
+	}
+
+	for (larger = class + 1; larger < HASHTABLE_POOL_CLASSES; ++larger)
+	{
+		block = hash_table->free_blocks[larger];
+		if (block)
+		{
+			hash_table->free_blocks[larger] = block->next;
+			HashTable_Pool_Free_Range(hash_table,
+						(char *)block + HashTable_Pool_Class_Size(class),
+						HashTable_Pool_Class_Size(larger) - HashTable_Pool_Class_Size(class));
+			HashTable_Count(hash_table, pool_splits, 1);
+			return block;
+		}
+	}
+
+	HashTable_Count(hash_table, pool_arena_allocs, 1);
+	/* blocks come back dirty from the free lists anyway, callers initialize what they use */
+	return arena_alloc_nozero(&hash_table->arena, HashTable_Pool_Class_Size(class));
+}
+
+static void
+HashTable_Pool_Free(HashTable *hash_table, void *ptr, size_t size)
+{
+	size_t class;
+	HashTable_Pool_Block *block = ptr;
+
+	if (ptr == NULL)
+	{
+		return;
+	}
+
+	class = HashTable_Pool_Class(size);
+	block->next = hash_table->free_blocks[class];
+	hash_table->free_blocks[class] = block;
+}
+
+static size_t
+HashTable_Bucket_Tags_Size(size_t capacity)
+{
+	return (capacity + HASHTABLE_TAG_GROUP - 1) / HASHTABLE_TAG_GROUP * HASHTABLE_TAG_GROUP;
+}
+
+/* tags, keys and values share one block: [tags][HashTable_Key keys][values] */
+static size_t
+HashTable_Bucket_Block_Size(HashTable *hash_table, size_t capacity)
+{
+	return HashTable_Bucket_Tags_Size(capacity) + capacity * (sizeof(HashTable_Key) + hash_table->value_size);
+}
+
+/* raises capacity to whatever fits in the pool block it needs */
+static size_t
+HashTable_Bucket_Fit_Capacity(HashTable *hash_table, size_t capacity)
+{
+	size_t block_size;
+
+	block_size = HashTable_Pool_Class_Size(HashTable_Pool_Class(HashTable_Bucket_Block_Size(hash_table, capacity)));
+	while (capacity < hash_table->bucket_max_capacity &&
+		HashTable_Bucket_Block_Size(hash_table, capacity + 1) <= block_size)
+	{
+		capacity += 1;
+	}
+
+	return capacity;
+}
+
+/*
+	moves the entries into a block for at least capacity entries, capacity 0
+	frees it. the capacity is raised to whatever fits in the pool block.
+*/
+static int
+HashTable_Bucket_Resize(HashTable *hash_table, HashTable_Bucket *bucket, size_t capacity)
+{
+	unsigned char *tags = NULL;
+	HashTable_Key *keys = NULL;
+	void *values = NULL;
+
+	assert(capacity >= bucket->size);
+
+	if (capacity)
+	{
+		HashTable_Count(hash_table, bucket_resizes, 1);
+		capacity = HashTable_Bucket_Fit_Capacity(hash_table, capacity);
+
+		tags = HashTable_Pool_Alloc(hash_table, HashTable_Bucket_Block_Size(hash_table, capacity));
+		if (!tags)
+		{
+			return 0;
+		}
+		keys = (HashTable_Key *)(tags + HashTable_Bucket_Tags_Size(capacity));
+		values = keys + capacity;
+
+		if (bucket->size)
+		{
+			memcpy(tags, bucket->tags, bucket->size);
+			memcpy(keys, bucket->keys, bucket->size * sizeof(HashTable_Key));
+			memcpy(values, bucket->values, bucket->size * hash_table->value_size);
+		}
+	}
+
+	HashTable_Pool_Free(hash_table, bucket->tags, HashTable_Bucket_Block_Size(hash_table, bucket->capacity));
+
+	bucket->tags = tags;
+	bucket->keys = keys;
+	bucket->values = values;
+	bucket->capacity = capacity;
+
+	return 1;
+}
+
+/* copies the live out of line key bytes into a block of key_bytes_capacity bytes, dropping dead ones */
+static int
+HashTable_Bucket_Repack_Keys(HashTable *hash_table, HashTable_Bucket *bucket, size_t key_bytes_capacity)
+{
+	char *key_bytes = NULL;
+	size_t i, used = 0;
+	String8 key;
+
+	if (key_bytes_capacity)
+	{
+		HashTable_Count(hash_table, key_repacks, 1);
+		key_bytes = HashTable_Pool_Alloc(hash_table, key_bytes_capacity);
+		if (!key_bytes)
+		{
+			return 0;
+		}
+		/* the pool rounds up, use all of it */
+		key_bytes_capacity = HashTable_Pool_Class_Size(HashTable_Pool_Class(key_bytes_capacity));
+
+		for (i = 0; i < bucket->size; ++i)
+		{
+			if (bucket->keys[i].len != HASHTABLE_KEY_OUT_OF_LINE)
+			{
+				continue;
+			}
+			key = HashTable_Key_View(&bucket->keys[i]);
+			memcpy(&key_bytes[used], key.ptr, key.len);
+			HashTable_Key_Set_Out_Of_Line(&bucket->keys[i], &key_bytes[used], key.len);
+			used += key.len;
+		}
+	}
+
+	HashTable_Pool_Free(hash_table, bucket->key_bytes, bucket->key_bytes_capacity);
+
+	bucket->key_bytes = key_bytes;
+	bucket->key_bytes_used = used;
+	bucket->key_bytes_capacity = key_bytes_capacity;
+	bucket->dead_key_bytes = 0;
+
+	return 1;
+}
+
+static size_t
+HashTable_Bucket_Search(HashTable *hash_table, HashTable_Bucket *bucket, String8 search_key, unsigned char tag)
+{
+	size_t base, i;
+	unsigned int match;
+
+	for (base = 0; base < bucket->size; base += HASHTABLE_TAG_GROUP)
+	{
+		HashTable_Count(hash_table, tag_groups_scanned, 1);
+		match = HashTable_Tags_Match(&bucket->tags[base], tag);
+		if (bucket->size - base < HASHTABLE_TAG_GROUP)
+		{
+			match &= (1u << (bucket->size - base)) - 1;
+		}
+
+		while (match)
+		{
+			i = base + HashTable_Mask_Next(&match);
+			HashTable_Count(hash_table, key_compares, 1);
+			if (HashTable_Key_Eq(&bucket->keys[i], search_key))
+			{
+				return i;
+			}
+			HashTable_Count(hash_table, tag_false_matches, 1);
+		}
+	}
+
+	return bucket->size;
+}
+
+/* swap-removes entry i, the last entry takes its place */
+static void
+HashTable_Bucket_Remove(HashTable *hash_table, HashTable_Bucket *bucket, size_t i)
+{
+	size_t last = bucket->size - 1;
+	size_t value_size = hash_table->value_size;
+
+	assert(i < bucket->size);
+	if (bucket->keys[i].len == HASHTABLE_KEY_OUT_OF_LINE)
+	{
+		bucket->dead_key_bytes += HashTable_Key_View(&bucket->keys[i]).len;
+	}
+
+	if (i != last)
+	{
+		bucket->keys[i] = bucket->keys[last];
+		bucket->tags[i] = bucket->tags[last];
+		memcpy(nth_no_bounds_checking(bucket->values, i, value_size),
+			nth_no_bounds_checking(bucket->values, last, value_size),
+			value_size);
+	}
+	bucket->size = last;
+
+	/* shrinking can only fail for lack of memory, in which case we keep what we have */
+	if (bucket->size == 0)
+	{
+		HashTable_Bucket_Resize(hash_table, bucket, 0);
+		HashTable_Bucket_Repack_Keys(hash_table, bucket, 0);
+		return;
+	}
+
+	if (bucket->size * 4 <= bucket->capacity && bucket->capacity / 2 >= hash_table->bucket_initial_capacity)
+	{
+		HashTable_Bucket_Resize(hash_table, bucket, bucket->capacity / 2);
+	}
+
+	if (bucket->dead_key_bytes * 100 > bucket->key_bytes_used * HASHTABLE_KEY_WASTE_PERCENT)
+	{
+		HashTable_Bucket_Repack_Keys(hash_table, bucket, bucket->key_bytes_used - bucket->dead_key_bytes);
+	}
+}
+
+/* appends a key known to be absent, returns bucket->size when the bucket is full or memory ran out */
+static size_t
+HashTable_Bucket_Append(HashTable *hash_table, HashTable_Bucket *bucket, String8 key, unsigned char tag, void *value)
+{
+	size_t capacity, live_key_bytes;
+
+	if (bucket->size == hash_table->bucket_max_capacity)
+	{
+		return bucket->size;
+	}
+
+	if (bucket->size == bucket->capacity)
+	{
+		capacity = bucket->capacity ? bucket->capacity * 2 : hash_table->bucket_initial_capacity;
+		if (capacity > hash_table->bucket_max_capacity)
+		{
+			capacity = hash_table->bucket_max_capacity;
+		}
+
+		if (!HashTable_Bucket_Resize(hash_table, bucket, capacity))
+		{
+			return bucket->size;
+		}
+	}
+
+	if (key.len <= HASHTABLE_INLINE_KEY)
+	{
+		memcpy(bucket->keys[bucket->size].bytes, key.ptr, key.len);
+		bucket->keys[bucket->size].len = (unsigned char)key.len;
+	}
+	else
+	{
+		if (bucket->key_bytes_used + key.len > bucket->key_bytes_capacity)
+		{
+			live_key_bytes = bucket->key_bytes_used - bucket->dead_key_bytes;
+			capacity = bucket->key_bytes_capacity * 2;
+			if (capacity < live_key_bytes + key.len)
+			{
+				capacity = live_key_bytes + key.len;
+			}
+
+			if (!HashTable_Bucket_Repack_Keys(hash_table, bucket, capacity))
+			{
+				return bucket->size;
+			}
+		}
+
+		memcpy(&bucket->key_bytes[bucket->key_bytes_used], key.ptr, key.len);
+		HashTable_Key_Set_Out_Of_Line(&bucket->keys[bucket->size], &bucket->key_bytes[bucket->key_bytes_used], key.len);
+		bucket->key_bytes_used += key.len;
+	}
+
+	bucket->tags[bucket->size] = tag;
+
+	memcpy(nth_no_bounds_checking(bucket->values, bucket->size, hash_table->value_size),
+		value,
+		hash_table->value_size);
+
+	return bucket->size++;
+}
+
+static int
+HashTable_BucketArray_Create(HashTable *hash_table, size_t bucket_count, HashTable_BucketArray *out_buckets)
+{
+	HashTable_BucketArray buckets;
+
+	memset(&buckets, 0, sizeof(buckets));
+
+	/* buckets start out empty, their storage is only taken from the pool on first insert */
+	buckets.ptr = HashTable_Pool_Alloc(hash_table, sizeof(HashTable_Bucket) * bucket_count);
+	if (!buckets.ptr)
+	{
+		return 0;
+	}
+	memset(buckets.ptr, 0, sizeof(HashTable_Bucket) * bucket_count);
+	buckets.size = buckets.capacity = bucket_count;
+
+	*out_buckets = buckets;
+
+	return 1;
+}
+
+/*
+	all table memory comes from buffer. with buffer == NULL the table reserves
+	buffer_size bytes of address space instead and commits it as it fills,
+	release it with HashTable_Destroy.
+*/
+HashTable
+HashTable_Create(size_t initial_bucket_count,
+		HashFn hash_fn,
+		size_t max_key_length, 
+		size_t value_size,
+		char *buffer, size_t buffer_size,
+		size_t bucket_max_capacity,
+		size_t bucket_initial_capacity)
+{
+	HashTable hash_table;
+	int ok;
+
+	assert(initial_bucket_count && bucket_initial_capacity && bucket_initial_capacity <= bucket_max_capacity);
+	assert(max_key_length <= UINT32_MAX && sizeof(char *) + sizeof(uint32_t) <= HASHTABLE_INLINE_KEY);
+
+	memset(&hash_table, 0, sizeof(hash_table));
+
+	hash_table.arena = buffer ? arena_init(buffer, buffer_size) : arena_reserve(buffer_size, 0);
+	hash_table.bucket_initial_capacity = bucket_initial_capacity;
+	hash_table.bucket_max_capacity = bucket_max_capacity;
+	hash_table.hash_fn = hash_fn;
+	hash_table.max_key_length = max_key_length;
+	hash_table.value_size = value_size;
+
+	ok = HashTable_BucketArray_Create(&hash_table, initial_bucket_count, &hash_table.buckets);
+	assert(ok);
+
+	return hash_table;
+}
+
+/* releases reserved table memory, a caller buffer is left to the caller */
+void
+HashTable_Destroy(HashTable *hash_table)
+{
+	arena_release(&hash_table->arena);
+	memset(hash_table, 0, sizeof(*hash_table));
+}
+
+static int
+HashTable_Is_Rehashing(HashTable *hash_table)
+{
+	return hash_table->rehash_buckets.ptr != NULL;
+}
+
+/*
+	moves the entries of an old bucket into the new array, last entry first.
+	SetSH drains the old bucket feeding a new bucket before inserting there
+	directly, so a new bucket only ever receives entries of its single old
+	bucket and moving cannot overflow bucket_max_capacity. when the arena
+	runs out, the entries not moved yet stay in the old bucket, where Find
+	still looks, and 0 is returned; the move resumes on a later call.
+*/
+static int
+HashTable_Rehash_Bucket(HashTable *hash_table, HashTable_Bucket *old_bucket)
+{
+	HashTable_Bucket *new_bucket;
+	String8 key;
+	size_t last, hash;
+
+	while (old_bucket->size)
+	{
+		last = old_bucket->size - 1;
+		key = HashTable_Key_View(&old_bucket->keys[last]);
+		hash = hash_table->hash_fn(key);
+		new_bucket = &hash_table->buckets.ptr[hash % hash_table->buckets.size];
+
+		if (HashTable_Bucket_Append(hash_table,
+				new_bucket,
+				key,
+				old_bucket->tags[last],
+				nth_no_bounds_checking(old_bucket->values, last, hash_table->value_size)) == new_bucket->size)
+		{
+			return 0;
+		}
+
+		if (old_bucket->keys[last].len == HASHTABLE_KEY_OUT_OF_LINE)
+		{
+			old_bucket->dead_key_bytes += key.len;
+		}
+		old_bucket->size = last;
+	}
+
+	HashTable_Bucket_Resize(hash_table, old_bucket, 0);
+	HashTable_Bucket_Repack_Keys(hash_table, old_bucket, 0);
+
+	return 1;
+}
+
+/* returns 0 when the arena ran out and the rehash is still in progress */
+static int
+HashTable_Rehash_Step(HashTable *hash_table, size_t step)
+{
+	HashTable_Bucket *old_bucket;
+
+	while (step-- && HashTable_Is_Rehashing(hash_table))
+	{
+		old_bucket = &hash_table->rehash_buckets.ptr[hash_table->rehash_index];
+		if (!HashTable_Rehash_Bucket(hash_table, old_bucket))
+		{
+			return 0;
+		}
+		HashTable_Count(hash_table, buckets_migrated, 1);
+
+		if (++hash_table->rehash_index == hash_table->rehash_buckets.size)
+		{
+			HashTable_Pool_Free(hash_table,
+				hash_table->rehash_buckets.ptr,
+				sizeof(HashTable_Bucket) * hash_table->rehash_buckets.capacity);
+			memset(&hash_table->rehash_buckets, 0, sizeof(hash_table->rehash_buckets));
+			hash_table->rehash_index = 0;
+		}
+	}
+
+	return 1;
+}
+
+/* returns 0 when there is no memory for the larger bucket array, the table keeps working without it */
+static int
+HashTable_Grow(HashTable *hash_table)
+{
+	HashTable_BucketArray buckets;
+
+	assert(!HashTable_Is_Rehashing(hash_table));
+
+	if (!HashTable_BucketArray_Create(hash_table, hash_table->buckets.size * 2, &buckets))
+	{
+		return 0;
+	}
+
+	hash_table->rehash_buckets = hash_table->buckets;
+	hash_table->rehash_index = 0;
+	hash_table->buckets = buckets;
+	hash_table->grows += 1;
+
+	return 1;
+}
+
+/* whether a full bucket, plus a key with hash, leaves room in its half once the bucket count doubles */
+static int
+HashTable_Bucket_Would_Split(HashTable *hash_table, HashTable_Bucket *bucket, size_t hash)
+{
+	size_t i, bucket_count = hash_table->buckets.size * 2, stay = 0;
+
+	for (i = 0; i < bucket->size; ++i)
+	{
+		stay += hash_table->hash_fn(HashTable_Key_View(&bucket->keys[i])) % bucket_count == hash % bucket_count;
+	}
+
+	return stay < hash_table->bucket_max_capacity;
+}
+
+/* returns the bucket holding key (and its index in *out_elem_id) or NULL */
+static HashTable_Bucket *
+HashTable_Find(HashTable *hash_table, String8 key, size_t hash, size_t *out_elem_id)
+{
+	HashTable_Bucket *bucket;
+	size_t bucket_id;
+
+	if (HashTable_Is_Rehashing(hash_table))
+	{
+		bucket_id = hash % hash_table->rehash_buckets.size;
+		if (bucket_id >= hash_table->rehash_index)
+		{
+			bucket = &hash_table->rehash_buckets.ptr[bucket_id];
+			*out_elem_id = HashTable_Bucket_Search(hash_table, bucket, key, HashTable_Tag(hash));
+			if (*out_elem_id < bucket->size)
+			{
+				return bucket;
+			}
+		}
+	}
+
+	bucket_id = hash % hash_table->buckets.size;
+	bucket = &hash_table->buckets.ptr[bucket_id];
+	*out_elem_id = HashTable_Bucket_Search(hash_table, bucket, key, HashTable_Tag(hash));
+
+	return *out_elem_id < bucket->size ? bucket : NULL;
+}
+
+/*
+	the key is borrowed, it is only copied into the table when a new entry is
+	inserted. the *SH variants take a hash precomputed with hash_table->hash_fn.
+	returns 0 when the key is too long, the arena is out of memory, or the
+	key's bucket is full and either a larger table would not split it or a
+	rehash is still running, the bucket can only double once that is done.
+*/
+int
+HashTable_SetSH(HashTable *hash_table, String8 key, size_t hash, void *value)
+{
+	size_t elem_id, bucket_id;
+	HashTable_Bucket *bucket;
+
+	if (key.len > hash_table->max_key_length)
+	{
+		return 0;
+	}
+
+	HashTable_Rehash_Step(hash_table, HASHTABLE_REHASH_STEP);
+	HashTable_Count(hash_table, sets, 1);
+
+	bucket = HashTable_Find(hash_table, key, hash, &elem_id);
+	if (bucket)
+	{
+		memcpy(nth_no_bounds_checking(bucket->values, elem_id, hash_table->value_size),
+			value,
+			hash_table->value_size);
+		return 1;
+	}
+
+	if (!HashTable_Is_Rehashing(hash_table) &&
+		hash_table->size + 1 > HASHTABLE_MAX_LOAD_FACTOR * hash_table->buckets.size)
+	{
+		HashTable_Grow(hash_table);
+	}
+
+	/* the old bucket feeding the target goes first, see HashTable_Rehash_Bucket */
+	if (HashTable_Is_Rehashing(hash_table))
+	{
+		bucket_id = hash % hash_table->rehash_buckets.size;
+		if (bucket_id >= hash_table->rehash_index &&
+			!HashTable_Rehash_Bucket(hash_table, &hash_table->rehash_buckets.ptr[bucket_id]))
+		{
+			return 0;
+		}
+	}
+
+	bucket = &hash_table->buckets.ptr[hash % hash_table->buckets.size];
+	if (bucket->size == hash_table->bucket_max_capacity)
+	{
+		/*
+			skewed bucket, grow right away instead of waiting for the load
+			factor. only the full bucket moves now, the rest of the table
+			follows in the usual steps. keys that share their hash modulo the
+			doubled bucket count stay together, doubling for them would only
+			repeat on every insert until the arena is gone.
+		*/
+		if (HashTable_Is_Rehashing(hash_table) ||
+			!HashTable_Bucket_Would_Split(hash_table, bucket, hash) ||
+			!HashTable_Grow(hash_table))
+		{
+			return 0;
+		}
+		HashTable_Count(hash_table, forced_grows, 1);
+		if (!HashTable_Rehash_Bucket(hash_table, &hash_table->rehash_buckets.ptr[hash % hash_table->rehash_buckets.size]))
+		{
+			return 0;
+		}
+		bucket = &hash_table->buckets.ptr[hash % hash_table->buckets.size];
+	}
+
+	if (HashTable_Bucket_Append(hash_table, bucket, key, HashTable_Tag(hash), value) == bucket->size)
+	{
+		return 0;
+	}
+
+	hash_table->size += 1;
+	HashTable_Count(hash_table, inserts, 1);
+
+	return 1;
+}
+
+/* lookup that never advances an in-progress rehash, so it only reads the table */
+int
+HashTable_PeekSH(HashTable *hash_table, String8 key, size_t hash, void *out_value)
+{
+	HashTable_Bucket *bucket;
+	size_t elem_id;
+
+	if (key.len > hash_table->max_key_length)
+	{
+		return 0;
+	}
+
+	HashTable_Count(hash_table, gets, 1);
+
+	bucket = HashTable_Find(hash_table, key, hash, &elem_id);
+	if (!bucket)
+	{
+		return 0;
+	}
+	HashTable_Count(hash_table, get_hits, 1);
+
+	if (out_value)
+	{
+		memcpy(out_value,
+			nth_no_bounds_checking(bucket->values, elem_id, hash_table->value_size),
+			hash_table->value_size);
+	}
+
+	return 1;
+}
+
+int
+HashTable_GetSH(HashTable *hash_table, String8 key, size_t hash, void *out_value)
+{
+	HashTable_Rehash_Step(hash_table, HASHTABLE_REHASH_STEP);
+
+	return HashTable_PeekSH(hash_table, key, hash, out_value);
+}
+
+int
+HashTable_RemoveSH(HashTable *hash_table, String8 key, size_t hash)
+{
+	HashTable_Bucket *bucket;
+	size_t elem_id;
+
+	if (key.len > hash_table->max_key_length)
+	{
+		return 0;
+	}
+
+	HashTable_Rehash_Step(hash_table, HASHTABLE_REHASH_STEP);
+
+	bucket = HashTable_Find(hash_table, key, hash, &elem_id);
+	if (!bucket)
+	{
+		return 0;
+	}
+
+	HashTable_Bucket_Remove(hash_table, bucket, elem_id);
+	hash_table->size -= 1;
+	HashTable_Count(hash_table, removes, 1);
+
+	return 1;
+}
+
+int
+HashTable_SetS(HashTable *hash_table, String8 key, void *value)
+{
+	return HashTable_SetSH(hash_table, key, hash_table->hash_fn(key), value);
+}
+
+int
+HashTable_GetS(HashTable *hash_table, String8 key, void *out_value)
+{
+	return HashTable_GetSH(hash_table, key, hash_table->hash_fn(key), out_value);
+}
+
+int
+HashTable_RemoveS(HashTable *hash_table, String8 key)
+{
+	return HashTable_RemoveSH(hash_table, key, hash_table->hash_fn(key));
+}
+
+int
+HashTable_Set(HashTable *hash_table, char *key, void *value)
+{
+	return HashTable_SetS(hash_table, string8_borrow(key), value);
+}
+
+int
+HashTable_Get(HashTable *hash_table, char *key, void *out_value)
+{
+	return HashTable_GetS(hash_table, string8_borrow(key), out_value);
+}
+
+int
+HashTable_Remove(HashTable *hash_table, char *key)
+{
+	return HashTable_RemoveS(hash_table, string8_borrow(key));
+}
+
+/* keys resolved per prefetch group by the batch calls */
+#ifndef HASHTABLE_BATCH_GROUP
+#define HASHTABLE_BATCH_GROUP 16
+#endif
+
+/*
+	group prefetching: hash every key of a group and prefetch its bucket
+	header, then prefetch the tags / keys of each bucket, and only then resolve
+	the lookups, so the cache misses of independent keys overlap instead of
+	being paid one after another.
+*/
+static void
+HashTable_Prefetch_Group(HashTable *hash_table, String8 *keys, size_t *hashes, size_t n)
+{
+	HashTable_Bucket *buckets[HASHTABLE_BATCH_GROUP][2];
+	size_t i, bucket_id;
+
+	assert(n <= HASHTABLE_BATCH_GROUP);
+
+	for (i = 0; i < n; ++i)
+	{
+		hashes[i] = hash_table->hash_fn(keys[i]);
+
+		buckets[i][0] = &hash_table->buckets.ptr[hashes[i] % hash_table->buckets.size];
+		buckets[i][1] = NULL;
+		HashTable_Prefetch(buckets[i][0]);
+
+		if (HashTable_Is_Rehashing(hash_table))
+		{
+			bucket_id = hashes[i] % hash_table->rehash_buckets.size;
+			if (bucket_id >= hash_table->rehash_index)
+			{
+				buckets[i][1] = &hash_table->rehash_buckets.ptr[bucket_id];
+				HashTable_Prefetch(buckets[i][1]);
+			}
+		}
+	}
+
+	for (i = 0; i < n; ++i)
+	{
+		HashTable_Prefetch(buckets[i][0]->tags);
+		HashTable_Prefetch(buckets[i][0]->keys);
+		if (buckets[i][1])
+		{
+			HashTable_Prefetch(buckets[i][1]->tags);
+			HashTable_Prefetch(buckets[i][1]->keys);
+		}
+	}
+}
+
+/*
+	out_values receives n values back to back and out_found a 0/1 flag per
+	key, both may be NULL. returns the number of keys found.
+*/
+size_t
+HashTable_GetBatch(HashTable *hash_table, String8 *keys, size_t n, void *out_values, int *out_found)
+{
+	size_t hashes[HASHTABLE_BATCH_GROUP];
+	size_t base, group, i, found = 0;
+	int ok;
+
+	for (base = 0; base < n; base += group)
+	{
+		group = n - base < HASHTABLE_BATCH_GROUP ? n - base : HASHTABLE_BATCH_GROUP;
+		HashTable_Prefetch_Group(hash_table, &keys[base], hashes, group);
+
+		for (i = 0; i < group; ++i)
+		{
+			ok = HashTable_GetSH(hash_table,
+					keys[base + i],
+					hashes[i],
+					out_values ? nth_no_bounds_checking(out_values, base + i, hash_table->value_size) : NULL);
+			if (out_found)
+			{
+				out_found[base + i] = ok;
+			}
+			found += ok;
+		}
+	}
+
+	return found;
+}
+
+/* values holds n values back to back, returns the number of keys set */
+size_t
+HashTable_SetBatch(HashTable *hash_table, String8 *keys, size_t n, void *values)
+{
+	size_t hashes[HASHTABLE_BATCH_GROUP];
+	size_t base, group, i, set = 0;
+
+	for (base = 0; base < n; base += group)
+	{
+		group = n - base < HASHTABLE_BATCH_GROUP ? n - base : HASHTABLE_BATCH_GROUP;
+		HashTable_Prefetch_Group(hash_table, &keys[base], hashes, group);
+
+		for (i = 0; i < group; ++i)
+		{
+			set += HashTable_SetSH(hash_table,
+					keys[base + i],
+					hashes[i],
+					nth_no_bounds_checking(values, base + i, hash_table->value_size));
+		}
+	}
+
+	return set;
+}
+
+/* buckets are counted by entry count up to HASHTABLE_STATS_OCCUPANCY - 1, the last slot takes all larger ones */
+#ifndef HASHTABLE_STATS_OCCUPANCY
+#define HASHTABLE_STATS_OCCUPANCY 64
+#endif
+
+/*
+	probe lengths are in tag groups scanned: a hit on entry i of a bucket
+	scans i / HASHTABLE_TAG_GROUP + 1 groups, a miss scans the whole bucket.
+	with a well distributed hash the occupancy variance stays close to the
+	load factor (bucket sizes are roughly poisson), a hash that clusters our
+	keys shows up as a larger variance and a longer tail in the histogram.
+*/
+typedef struct {
+	size_t size;
+	size_t bucket_count;
+	size_t rehash_bucket_count; /* old buckets not migrated yet */
+	double load_factor;
+	size_t grows;
+
+	size_t occupancy[HASHTABLE_STATS_OCCUPANCY];
+	double occupancy_variance;
+	size_t max_bucket_size;
+	size_t full_buckets; /* at bucket_max_capacity, the next insert there forces a grow if that splits the bucket and no rehash is running */
+
+	double avg_hit_probe;
+	size_t max_hit_probe;
+	double avg_miss_probe;
+
+	size_t arena_capacity;
+	size_t arena_used;
+	size_t pool_free_bytes; /* blocks waiting on the free lists */
+	size_t bucket_array_bytes;
+	size_t entry_bytes_reserved; /* [tags][keys][values] blocks, as handed out by the pool */
+	size_t entry_bytes_used;
+	size_t key_bytes_reserved; /* out of line key blocks */
+	size_t key_bytes_used;
+	size_t key_bytes_dead;
+	size_t inline_keys;
+	size_t out_of_line_keys;
+
+#ifdef HASHTABLE_COUNTERS
+	HashTable_Counters counters;
+#endif
+} HashTable_Stats;
+
+static void
+HashTable_Stats_Add_Buckets(HashTable *hash_table, HashTable_BucketArray *buckets, size_t first, HashTable_Stats *stats)
+{
+	HashTable_Bucket *bucket;
+	size_t i, j;
+
+	stats->bucket_array_bytes += HashTable_Pool_Class_Size(HashTable_Pool_Class(sizeof(HashTable_Bucket) * buckets->capacity));
+
+	for (i = first; i < buckets->size; ++i)
+	{
+		bucket = &buckets->ptr[i];
+
+		if (bucket->capacity)
+		{
+			stats->entry_bytes_reserved += HashTable_Pool_Class_Size(HashTable_Pool_Class(HashTable_Bucket_Block_Size(hash_table, bucket->capacity)));
+			stats->entry_bytes_used += bucket->size * (1 + sizeof(HashTable_Key) + hash_table->value_size);
+		}
+		stats->key_bytes_reserved += bucket->key_bytes_capacity;
+		stats->key_bytes_used += bucket->key_bytes_used - bucket->dead_key_bytes;
+		stats->key_bytes_dead += bucket->dead_key_bytes;
+
+		for (j = 0; j < bucket->size; ++j)
+		{
+			if (bucket->keys[j].len == HASHTABLE_KEY_OUT_OF_LINE)
+			{
+				stats->out_of_line_keys += 1;
+			}
+			else
+			{
+				stats->inline_keys += 1;
+			}
+		}
+	}
+}
+
+/* walks every bucket and free list, meant for diagnostics rather than the hot path */
+HashTable_Stats
+HashTable_Stats_Get(HashTable *hash_table)
+{
+	HashTable_Stats stats;
+	HashTable_Bucket *bucket;
+	HashTable_Pool_Block *block;
+	size_t i, class, groups, entries = 0, hit_groups = 0, miss_groups = 0;
+	double mean, sum_squares = 0;
+
+	memset(&stats, 0, sizeof(stats));
+
+	stats.size = hash_table->size;
+	stats.bucket_count = hash_table->buckets.size;
+	stats.load_factor = (double)hash_table->size / (double)hash_table->buckets.size;
+	stats.grows = hash_table->grows;
+
+	/* occupancy and probes describe the bucket array new entries go to */
+	for (i = 0; i < hash_table->buckets.size; ++i)
+	{
+		bucket = &hash_table->buckets.ptr[i];
+		entries += bucket->size;
+
+		stats.occupancy[bucket->size < HASHTABLE_STATS_OCCUPANCY ? bucket->size : HASHTABLE_STATS_OCCUPANCY - 1] += 1;
+		sum_squares += (double)bucket->size * (double)bucket->size;
+		if (bucket->size > stats.max_bucket_size)
+		{
+			stats.max_bucket_size = bucket->size;
+		}
+		if (bucket->size == hash_table->bucket_max_capacity)
+		{
+			stats.full_buckets += 1;
+		}
+
+		groups = (bucket->size + HASHTABLE_TAG_GROUP - 1) / HASHTABLE_TAG_GROUP;
+		miss_groups += groups;
+		/* full groups contribute 1, 2, ... groups per entry, the last one may be partial */
+		if (groups)
+		{
+			hit_groups += HASHTABLE_TAG_GROUP * (groups - 1) * groups / 2 +
+				(bucket->size - (groups - 1) * HASHTABLE_TAG_GROUP) * groups;
+		}
+		if (groups > stats.max_hit_probe)
+		{
+			stats.max_hit_probe = groups;
+		}
+	}
+
+	mean = (double)entries / (double)stats.bucket_count;
+	stats.occupancy_variance = sum_squares / (double)stats.bucket_count - mean * mean;
+	stats.avg_miss_probe = (double)miss_groups / (double)stats.bucket_count;
+	stats.avg_hit_probe = entries ? (double)hit_groups / (double)entries : 0;
+
+	stats.arena_capacity = hash_table->arena.buffer_size;
+	stats.arena_used = hash_table->arena.current_offset;
+	for (class = 0; class < HASHTABLE_POOL_CLASSES; ++class)
+	{
+		for (block = hash_table->free_blocks[class]; block; block = block->next)
+		{
+			stats.pool_free_bytes += HashTable_Pool_Class_Size(class);
+		}
+	}
+
+	HashTable_Stats_Add_Buckets(hash_table, &hash_table->buckets, 0, &stats);
+	if (HashTable_Is_Rehashing(hash_table))
+	{
+		stats.rehash_bucket_count = hash_table->rehash_buckets.size - hash_table->rehash_index;
+		HashTable_Stats_Add_Buckets(hash_table, &hash_table->rehash_buckets, hash_table->rehash_index, &stats);
+	}
+
+#ifdef HASHTABLE_COUNTERS
+	stats.counters = hash_table->counters;
+#endif
+
+	return stats;
+}
+
+void
+HashTable_Stats_Print(FILE *file, HashTable_Stats *stats)
+{
+	size_t i, last = 0;
+
+	fprintf(file, "size %zu, buckets %zu (+%zu rehashing), load factor %.2f, grows %zu\n",
+		stats->size, stats->bucket_count, stats->rehash_bucket_count, stats->load_factor, stats->grows);
+	fprintf(file, "occupancy variance %.2f, max bucket %zu, full buckets %zu\n",
+		stats->occupancy_variance, stats->max_bucket_size, stats->full_buckets);
+	fprintf(file, "probe groups: hit avg %.3f max %zu, miss avg %.3f\n",
+		stats->avg_hit_probe, stats->max_hit_probe, stats->avg_miss_probe);
+
+	for (i = 0; i < HASHTABLE_STATS_OCCUPANCY; ++i)
+	{
+		if (stats->occupancy[i])
+		{
+			last = i;
+		}
+	}
+	fprintf(file, "occupancy histogram (entries: buckets)\n");
+	for (i = 0; i <= last; ++i)
+	{
+		fprintf(file, "  %2zu%s: %zu\n", i, i == HASHTABLE_STATS_OCCUPANCY - 1 ? "+" : " ", stats->occupancy[i]);
+	}
+
+	fprintf(file, "arena %zu / %zu bytes, %zu on pool free lists\n",
+		stats->arena_used, stats->arena_capacity, stats->pool_free_bytes);
+	fprintf(file, "bucket arrays %zu bytes\n", stats->bucket_array_bytes);
+	fprintf(file, "entries %zu used / %zu reserved bytes\n", stats->entry_bytes_used, stats->entry_bytes_reserved);
+	fprintf(file, "key bytes %zu used + %zu dead / %zu reserved, keys %zu inline %zu out of line\n",
+		stats->key_bytes_used, stats->key_bytes_dead, stats->key_bytes_reserved,
+		stats->inline_keys, stats->out_of_line_keys);
+
+#ifdef HASHTABLE_COUNTERS
+	fprintf(file, "gets %zu (%zu hits), sets %zu (%zu inserts), removes %zu\n",
+		stats->counters.gets, stats->counters.get_hits,
+		stats->counters.sets, stats->counters.inserts,
+		stats->counters.removes);
+	fprintf(file, "tag groups scanned %zu, key compares %zu, tag false matches %zu\n",
+		stats->counters.tag_groups_scanned, stats->counters.key_compares, stats->counters.tag_false_matches);
+	fprintf(file, "buckets migrated %zu, forced grows %zu, bucket resizes %zu, key repacks %zu\n",
+		stats->counters.buckets_migrated, stats->counters.forced_grows,
+		stats->counters.bucket_resizes, stats->counters.key_repacks);
+	fprintf(file, "pool reuses %zu, splits %zu, arena allocs %zu\n",
+		stats->counters.pool_reuses, stats->counters.pool_splits, stats->counters.pool_arena_allocs);
+#endif
+}
+
+size_t FNV1a_Hash(String8 key) {
+	size_t hash = 0xcbf29ce484222325ULL;  // FNV offset basis
+	for (size_t i = 0; i < key.len; i++) {
+		hash ^= (unsigned char)key.ptr[i];
+		hash *= 0x100000001b3ULL;  // FNV prime
+	}
+	return hash;
+}
+
+size_t Wy_Hash(String8 key) {
+	return (size_t)hash_wy(key.ptr, key.len, hash_seed);
+}
+
+size_t Aes_Hash(String8 key) {
+	return (size_t)hash_aes(key.ptr, key.len, hash_seed);
+}
+
+#endif /* HT_BUCKET_H */
@@ -0,0 +1,196 @@
+#include "ht_build.h"
+
+/*
+	builds the same table with HashTable_SetS one record at a time and with
+	HashTable_BuildParallel on 1, 2, 4... threads, then once more into a
+	table on a reserved arena, checks every build and prints the times.
+	also checks that repeated keys do not count against a bucket and that a
+	bucket no grow can split fails the build without touching the table.
+	usage: ht_build [max_threads] [count]
+*/
+
+#define BUFFER_SIZE (256 * 1024 * 1024)
+static char buffer[BUFFER_SIZE];
+
+#define DEFAULT_COUNT 2000000
+#define INITIAL_BUCKET_COUNT 1024
+#define MAX_KEY_LENGTH 32
+#define BUCKET_MAX_CAPACITY 48
+#define BUCKET_INITIAL_CAPACITY 4
+
+/* table_buffer NULL reserves the table its own arena */
+static HashTable
+table_create(char *table_buffer)
+{
+	return HashTable_Create(INITIAL_BUCKET_COUNT,
+				Wy_Hash,
+				MAX_KEY_LENGTH,
+				sizeof(uint64_t),
+				table_buffer, BUFFER_SIZE,
+				BUCKET_MAX_CAPACITY,
+				BUCKET_INITIAL_CAPACITY);
+}
+
+static void
+table_check(HashTable *hash_table, String8 *keys, size_t distinct)
+{
+	uint64_t value;
+	size_t i;
+	int ok;
+
+	assert(hash_table->size == distinct);
+	for (i = 0; i < distinct; ++i)
+	{
+		ok = HashTable_GetS(hash_table, keys[i], &value);
+		assert(ok);
+		/* the duplicate at i + distinct came later and wins */
+		assert(value == (i < hash_table->size / 8 ? i + distinct : i));
+	}
+	assert(!HashTable_Get(hash_table, "missing", NULL));
+}
+
+static size_t
+Same_Hash(String8 key)
+{
+	(void)key;
+	return 7;
+}
+
+static void
+crowded_buckets(size_t thread_count)
+{
+	String8 keys[2 * BUCKET_MAX_CAPACITY + 4];
+	uint64_t values[2 * BUCKET_MAX_CAPACITY + 4], value;
+	char key_bytes[2 * BUCKET_MAX_CAPACITY + 4][8];
+	HashTable hash_table;
+	HashTable_Bucket *buckets;
+	size_t i, n = sizeof(keys) / sizeof(keys[0]);
+
+	/* one key, more copies than a bucket holds: the last copy wins like a run of Sets */
+	for (i = 0; i < n; ++i)
+	{
+		keys[i] = string8_borrow("same");
+		values[i] = i;
+	}
+	hash_table = HashTable_Create(16, Wy_Hash, MAX_KEY_LENGTH, sizeof(uint64_t), buffer, BUFFER_SIZE, BUCKET_MAX_CAPACITY, BUCKET_INITIAL_CAPACITY);
+	assert(HashTable_BuildParallel(&hash_table, keys, values, n, thread_count) == n);
+	assert(hash_table.size == 1 && hash_table.buckets.size == 16);
+	assert(HashTable_Get(&hash_table, "same", &value) && value == n - 1);
+
+	/* distinct keys that all hash alike, no bucket count splits them */
+	for (i = 0; i < n; ++i)
+	{
+		keys[i].ptr = key_bytes[i];
+		keys[i].len = snprintf(key_bytes[i], sizeof(key_bytes[i]), "s%zu", i);
+	}
+	hash_table = HashTable_Create(16, Same_Hash, MAX_KEY_LENGTH, sizeof(uint64_t), buffer, BUFFER_SIZE, BUCKET_MAX_CAPACITY, BUCKET_INITIAL_CAPACITY);
+	buckets = hash_table.buckets.ptr;
+	assert(HashTable_BuildParallel(&hash_table, keys, values, n, thread_count) == 0);
+	assert(hash_table.size == 0 && hash_table.buckets.ptr == buckets && hash_table.buckets.size == 16);
+	for (i = 0; i < hash_table.buckets.size; ++i)
+	{
+		assert(hash_table.buckets.ptr[i].size == 0 && hash_table.buckets.ptr[i].capacity == 0);
+	}
+
+	/* the table still takes what fits */
+	for (i = 0; i < BUCKET_MAX_CAPACITY; ++i)
+	{
+		assert(HashTable_SetS(&hash_table, keys[i], &values[i]));
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t max_threads = argc > 1 ? (size_t)atoi(argv[1]) : thread_hw_count();
+	size_t count = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : DEFAULT_COUNT;
+	size_t n, i, threads, taken;
+	HashTable hash_table;
+	String8 *keys;
+	uint64_t *values, start;
+	char *key_bytes;
+	int ok;
+
+	if (max_threads == 0 || max_threads > HASHTABLE_BUILD_MAX_THREADS)
+	{
+		max_threads = HASHTABLE_BUILD_MAX_THREADS;
+	}
+
+	/* count distinct keys, the first eighth of them repeated at the end, every fourth one out of line */
+	n = count + count / 8;
+	keys = malloc(n * sizeof(String8));
+	values = malloc(n * sizeof(uint64_t));
+	key_bytes = malloc(count * (MAX_KEY_LENGTH + 1));
+	assert("OOM" && keys && values && key_bytes);
+
+	for (i = 0; i < count; ++i)
+	{
+		keys[i].ptr = &key_bytes[i * (MAX_KEY_LENGTH + 1)];
+		keys[i].len = snprintf(keys[i].ptr, MAX_KEY_LENGTH + 1, i % 4 ? "b%zu" : "bulk_loaded_key_%zu", i);
+		values[i] = i;
+	}
+	for (i = count; i < n; ++i)
+	{
+		keys[i] = keys[i - count];
+		values[i] = i;
+	}
+
+	printf("%-10s %8s %12s\n", "build", "threads", "ms");
+
+	hash_table = table_create(buffer);
+	start = time_now_ns();
+	for (i = 0; i < n; ++i)
+	{
+		ok = HashTable_SetS(&hash_table, keys[i], &values[i]);
+		assert(ok);
+	}
+	printf("%-10s %8d %12.2f\n", "set", 1, (double)(time_now_ns() - start) / 1e6);
+	table_check(&hash_table, keys, count);
+
+	for (threads = 1; ; threads *= 2)
+	{
+		if (threads > max_threads)
+		{
+			threads = max_threads;
+		}
+
+		hash_table = table_create(buffer);
+		start = time_now_ns();
+		taken = HashTable_BuildParallel(&hash_table, keys, values, n, threads);
+		printf("%-10s %8zu %12.2f\n", "parallel", threads, (double)(time_now_ns() - start) / 1e6);
+		assert(taken == n);
+		table_check(&hash_table, keys, count);
+
+		if (threads == max_threads)
+		{
+			break;
+		}
+	}
+
+	/* scratch comes from a scratch arena of this thread rather than the end of the table arena */
+	hash_table = table_create(NULL);
+	assert(hash_table.arena.flags & ARENA_RESERVED);
+	start = time_now_ns();
+	taken = HashTable_BuildParallel(&hash_table, keys, values, n, max_threads);
+	printf("%-10s %8zu %12.2f\n", "reserved", max_threads, (double)(time_now_ns() - start) / 1e6);
+	assert(taken == n);
+	table_check(&hash_table, keys, count);
+
+	/* the table keeps working as usual after a bulk load */
+	for (i = 0; i < count; i += 2)
+	{
+		ok = HashTable_RemoveS(&hash_table, keys[i]);
+		assert(ok);
+	}
+	assert(HashTable_Set(&hash_table, "after_build", &values[0]));
+	assert(hash_table.size == count - (count + 1) / 2 + 1);
+	HashTable_Destroy(&hash_table);
+
+	crowded_buckets(max_threads);
+
+	free(keys);
+	free(values);
+	free(key_bytes);
+
+	return 0;
+}
@@ -0,0 +1,503 @@
+#ifndef HT_BUILD_H
+#define HT_BUILD_H
+
+#include "ht_bucket.h"
+
+/*
+	bulk load of an empty HashTable from arrays of keys and values, split
+	over threads in radix partitioning passes. thread t owns the contiguous
+	bucket range of partition t, so once the records are grouped by
+	partition every thread fills its own buckets without locks:
+
+	1. hash:    each thread hashes a slice of the input and counts records per partition
+	2. scatter: each thread writes its record indices to the partition's slot range
+	3. size:    each thread counts records and out of line key bytes per bucket
+	4. fill:    each thread carves its buckets' blocks out of a private arena slice
+	            and appends its records in input order
+
+	the bucket count is picked up front for a load factor of 3/4 of
+	HASHTABLE_MAX_LOAD_FACTOR. the counts include duplicate keys, so they
+	only bound a bucket: blocks are sized from them, capped at
+	bucket_max_capacity, and a bucket really overflows only when the fill
+	finds one more distinct key than fits. the fill is then undone and the
+	bucket count doubled, if doubling splits that bucket (same test as a
+	forced grow in Set), else the build fails. the build never goes through
+	the pool free lists. the hashes and record order live at the far end of
+	the table arena while the build runs.
+*/
+
+#ifndef HASHTABLE_BUILD_MAX_THREADS
+#define HASHTABLE_BUILD_MAX_THREADS 64
+#endif
+
+typedef struct {
+	HashTable *hash_table;
+	String8 *keys;
+	char *values;
+	size_t n;
+	size_t thread_count;
+
+	size_t *hashes;
+	size_t *order; /* record indices grouped by partition */
+	size_t *cursors; /* thread_count * thread_count, [input slice][partition] */
+	size_t *partition_start; /* thread_count + 1 */
+} HashTable_Build;
+
+typedef struct HashTable_Build_Worker {
+	HashTable_Build *build;
+	size_t index; /* input slice in the hash and scatter phases, partition after */
+	void (*phase)(struct HashTable_Build_Worker *worker);
+
+	size_t bytes; /* storage the partition needs, from the size phase */
+	char *slice;
+	size_t inserted;
+	int overfull; /* the fill met a full bucket, overfull_hash is the key that did not fit */
+	size_t overfull_hash;
+} HashTable_Build_Worker;
+
+static size_t
+HashTable_Build_Partition(HashTable_Build *build, size_t bucket_id)
+{
+	return bucket_id * build->thread_count / build->hash_table->buckets.size;
+}
+
+static size_t
+HashTable_Build_First_Bucket(HashTable_Build *build, size_t partition)
+{
+	size_t bucket_count = build->hash_table->buckets.size;
+
+	return (partition * bucket_count + build->thread_count - 1) / build->thread_count;
+}
+
+static int
+HashTable_Build_Accepts(HashTable_Build *build, size_t i)
+{
+	return build->keys[i].len <= build->hash_table->max_key_length;
+}
+
+static void
+HashTable_Build_Hash(HashTable_Build_Worker *worker)
+{
+	HashTable_Build *build = worker->build;
+	size_t t = worker->index;
+	size_t i, first = t * build->n / build->thread_count, last = (t + 1) * build->n / build->thread_count;
+	size_t *counts = &build->cursors[t * build->thread_count];
+	HashTable *hash_table = build->hash_table;
+
+	for (i = first; i < last; ++i)
+	{
+		if (HashTable_Build_Accepts(build, i))
+		{
+			build->hashes[i] = hash_table->hash_fn(build->keys[i]);
+			counts[HashTable_Build_Partition(build, build->hashes[i] % hash_table->buckets.size)] += 1;
+		}
+	}
+}
+
+static void
+HashTable_Build_Scatter(HashTable_Build_Worker *worker)
+{
+	HashTable_Build *build = worker->build;
+	size_t t = worker->index;
+	size_t i, first = t * build->n / build->thread_count, last = (t + 1) * build->n / build->thread_count;
+	size_t *cursors = &build->cursors[t * build->thread_count];
+	size_t bucket_count = build->hash_table->buckets.size;
+
+	for (i = first; i < last; ++i)
+	{
+		if (HashTable_Build_Accepts(build, i))
+		{
+			build->order[cursors[HashTable_Build_Partition(build, build->hashes[i] % bucket_count)]++] = i;
+		}
+	}
+}
+
+/*
+	bucket->capacity and bucket->key_bytes_capacity hold the counts until the
+	fill phase, the entry count capped at bucket_max_capacity
+*/
+static void
+HashTable_Build_Size(HashTable_Build_Worker *worker)
+{
+	HashTable_Build *build = worker->build;
+	size_t p = worker->index;
+	HashTable *hash_table = build->hash_table;
+	HashTable_Bucket *bucket;
+	String8 key;
+	size_t i, b, last_bucket;
+
+	for (i = build->partition_start[p]; i < build->partition_start[p + 1]; ++i)
+	{
+		key = build->keys[build->order[i]];
+		bucket = &hash_table->buckets.ptr[build->hashes[build->order[i]] % hash_table->buckets.size];
+		bucket->capacity += 1;
+		if (key.len > HASHTABLE_INLINE_KEY)
+		{
+			bucket->key_bytes_capacity += key.len;
+		}
+	}
+
+	worker->bytes = 0;
+	last_bucket = HashTable_Build_First_Bucket(build, p + 1);
+	for (b = HashTable_Build_First_Bucket(build, p); b < last_bucket; ++b)
+	{
+		bucket = &hash_table->buckets.ptr[b];
+		if (bucket->capacity > hash_table->bucket_max_capacity)
+		{
+			bucket->capacity = hash_table->bucket_max_capacity;
+		}
+		if (bucket->capacity)
+		{
+			worker->bytes += HashTable_Pool_Class_Size(HashTable_Pool_Class(HashTable_Bucket_Block_Size(hash_table, bucket->capacity)));
+		}
+		if (bucket->key_bytes_capacity)
+		{
+			worker->bytes += HashTable_Pool_Class_Size(HashTable_Pool_Class(bucket->key_bytes_capacity));
+		}
+	}
+}
+
+static void
+HashTable_Build_Fill(HashTable_Build_Worker *worker)
+{
+	HashTable_Build *build = worker->build;
+	size_t p = worker->index;
+	HashTable *hash_table = build->hash_table;
+	HashTable_Bucket *bucket;
+	size_t i, b, last_bucket, capacity, elem_id, record, hash;
+	char *slice = worker->slice;
+
+	last_bucket = HashTable_Build_First_Bucket(build, p + 1);
+	for (b = HashTable_Build_First_Bucket(build, p); b < last_bucket; ++b)
+	{
+		bucket = &hash_table->buckets.ptr[b];
+
+		if (bucket->capacity)
+		{
+			capacity = HashTable_Bucket_Fit_Capacity(hash_table, bucket->capacity);
+			bucket->tags = (unsigned char *)slice;
+			bucket->keys = (HashTable_Key *)(slice + HashTable_Bucket_Tags_Size(capacity));
+			bucket->values = bucket->keys + capacity;
+			bucket->capacity = capacity;
+			slice += HashTable_Pool_Class_Size(HashTable_Pool_Class(HashTable_Bucket_Block_Size(hash_table, capacity)));
+		}
+
+		if (bucket->key_bytes_capacity)
+		{
+			bucket->key_bytes = slice;
+			bucket->key_bytes_capacity = HashTable_Pool_Class_Size(HashTable_Pool_Class(bucket->key_bytes_capacity));
+			slice += bucket->key_bytes_capacity;
+		}
+	}
+	assert(slice == worker->slice + worker->bytes);
+
+	/* later duplicates overwrite earlier ones, like a run of Sets would */
+	worker->inserted = 0;
+	worker->overfull = 0;
+	for (i = build->partition_start[p]; i < build->partition_start[p + 1]; ++i)
+	{
+		record = build->order[i];
+		hash = build->hashes[record];
+		bucket = &hash_table->buckets.ptr[hash % hash_table->buckets.size];
+
+		elem_id = HashTable_Bucket_Search(hash_table, bucket, build->keys[record], HashTable_Tag(hash));
+		if (elem_id < bucket->size)
+		{
+			memcpy(nth_no_bounds_checking(bucket->values, elem_id, hash_table->value_size),
+				nth_no_bounds_checking(build->values, record, hash_table->value_size),
+				hash_table->value_size);
+			continue;
+		}
+
+		/* the blocks hold every record up to bucket_max_capacity, so this never reallocates */
+		elem_id = HashTable_Bucket_Append(hash_table,
+					bucket,
+					build->keys[record],
+					HashTable_Tag(hash),
+					nth_no_bounds_checking(build->values, record, hash_table->value_size));
+		if (elem_id == bucket->size)
+		{
+			worker->overfull = 1;
+			worker->overfull_hash = hash;
+			return;
+		}
+		worker->inserted += 1;
+	}
+}
+
+static void *
+HashTable_Build_Thread(void *arg)
+{
+	HashTable_Build_Worker *worker = arg;
+
+	worker->phase(worker);
+
+	return NULL;
+}
+
+/* runs phase for every index, worker 0 on the calling thread */
+static void
+HashTable_Build_Run(HashTable_Build_Worker *workers, size_t count, void (*phase)(HashTable_Build_Worker *worker))
+{
+	thread_t threads[HASHTABLE_BUILD_MAX_THREADS];
+	int started[HASHTABLE_BUILD_MAX_THREADS];
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+	{
+		workers[i].phase = phase;
+	}
+
+	for (i = 1; i < count; ++i)
+	{
+		started[i] = thread_create(&threads[i], HashTable_Build_Thread, &workers[i]);
+	}
+
+	HashTable_Build_Thread(&workers[0]);
+
+	for (i = 1; i < count; ++i)
+	{
+		if (started[i])
+		{
+			thread_join(threads[i]);
+		}
+		else
+		{
+			/* out of threads, the phase still completes, just not in parallel */
+			HashTable_Build_Thread(&workers[i]);
+		}
+	}
+}
+
+/*
+	swaps in an empty array of bucket_count buckets, returns 0 if the arena
+	has no room. the array the build started with is kept for a failed build
+	to go back to, the ones in between go back to the pool.
+*/
+static int
+HashTable_Build_Resize_Buckets(HashTable *hash_table, size_t bucket_count, HashTable_BucketArray *original)
+{
+	HashTable_BucketArray buckets;
+
+	if (!HashTable_BucketArray_Create(hash_table, bucket_count, &buckets))
+	{
+		return 0;
+	}
+
+	if (hash_table->buckets.ptr != original->ptr)
+	{
+		HashTable_Pool_Free(hash_table,
+			hash_table->buckets.ptr,
+			sizeof(HashTable_Bucket) * hash_table->buckets.capacity);
+	}
+	hash_table->buckets = buckets;
+
+	return 1;
+}
+
+/* a failed build puts the original array back, emptied; a finished one lets it go */
+static void
+HashTable_Build_Release_Buckets(HashTable *hash_table, HashTable_BucketArray *original, int ok)
+{
+	if (hash_table->buckets.ptr == original->ptr)
+	{
+		if (!ok)
+		{
+			memset(original->ptr, 0, sizeof(HashTable_Bucket) * original->size);
+		}
+		return;
+	}
+
+	if (ok)
+	{
+		HashTable_Pool_Free(hash_table, original->ptr, sizeof(HashTable_Bucket) * original->capacity);
+		return;
+	}
+
+	HashTable_Pool_Free(hash_table,
+		hash_table->buckets.ptr,
+		sizeof(HashTable_Bucket) * hash_table->buckets.capacity);
+	hash_table->buckets = *original;
+	memset(original->ptr, 0, sizeof(HashTable_Bucket) * original->size);
+}
+
+/*
+	inserts keys[i] -> the i-th value_size bytes of values for i < n into an
+	empty table, using up to thread_count threads. keys longer than
+	max_key_length are skipped like Set skips them. returns the number of
+	records taken, or 0 when the arena is too small or more distinct keys
+	share a bucket than doubling the bucket count can split, the table is
+	left empty with its bucket array as it was then.
+*/
+size_t
+HashTable_BuildParallel(HashTable *hash_table, String8 *keys, void *values, size_t n, size_t thread_count)
+{
+	HashTable_Build build;
+	HashTable_Build_Worker workers[HASHTABLE_BUILD_MAX_THREADS];
+	size_t i, t, p, bucket_count, scratch_size, accepted, arena_buffer_size;
+	uintptr_t scratch;
+	Arena *conflict = &hash_table->arena;
+	ArenaSave save, thread_scratch;
+	HashTable_BucketArray original;
+	HashTable_Build_Worker *overfull;
+	int ok = 1;
+
+	assert(hash_table->size == 0 && !HashTable_Is_Rehashing(hash_table));
+
+	if (thread_count == 0)
+	{
+		thread_count = 1;
+	}
+	if (thread_count > HASHTABLE_BUILD_MAX_THREADS)
+	{
+		thread_count = HASHTABLE_BUILD_MAX_THREADS;
+	}
+
+	original = hash_table->buckets;
+	bucket_count = n * 4 / (HASHTABLE_MAX_LOAD_FACTOR * 3) + 1;
+	if (bucket_count > hash_table->buckets.size && !HashTable_Build_Resize_Buckets(hash_table, bucket_count, &original))
+	{
+		return 0;
+	}
+	if (thread_count > hash_table->buckets.size)
+	{
+		thread_count = hash_table->buckets.size;
+	}
+
+	/*
+		scratch comes off the end of the arena so the bucket blocks can keep
+		growing from the front. a reserved arena has no memory behind its end
+		yet, there it comes from a scratch arena of this thread.
+	*/
+	scratch_size = (2 * n + thread_count * thread_count + thread_count + 1) * sizeof(size_t) + sizeof(size_t);
+	arena_buffer_size = hash_table->arena.buffer_size;
+	memset(&thread_scratch, 0, sizeof(thread_scratch));
+	if (hash_table->arena.flags & ARENA_RESERVED)
+	{
+		thread_scratch = scratch_begin(&conflict, 1);
+		scratch = (uintptr_t)arena_alloc_nozero(thread_scratch.arena, scratch_size);
+		if (!scratch)
+		{
+			scratch_end(thread_scratch);
+			HashTable_Build_Release_Buckets(hash_table, &original, 0);
+			return 0;
+		}
+	}
+	else
+	{
+		if (scratch_size > arena_buffer_size - hash_table->arena.current_offset)
+		{
+			HashTable_Build_Release_Buckets(hash_table, &original, 0);
+			return 0;
+		}
+		scratch = ((uintptr_t)hash_table->arena.buffer + arena_buffer_size - scratch_size + sizeof(size_t)) & ~(uintptr_t)(sizeof(size_t) - 1);
+		hash_table->arena.buffer_size = scratch - (uintptr_t)hash_table->arena.buffer;
+	}
+
+	memset(&build, 0, sizeof(build));
+	build.hash_table = hash_table;
+	build.keys = keys;
+	build.values = values;
+	build.n = n;
+	build.thread_count = thread_count;
+	build.hashes = (size_t *)scratch;
+	build.order = build.hashes + n;
+	build.cursors = build.order + n;
+	build.partition_start = build.cursors + thread_count * thread_count;
+
+	memset(workers, 0, sizeof(workers));
+	for (t = 0; t < thread_count; ++t)
+	{
+		workers[t].build = &build;
+		workers[t].index = t;
+	}
+
+	for (;;)
+	{
+		memset(build.cursors, 0, thread_count * thread_count * sizeof(size_t));
+		HashTable_Build_Run(workers, thread_count, HashTable_Build_Hash);
+
+		/* counts become write cursors: partitions in order, input slices in order inside each */
+		accepted = 0;
+		for (p = 0; p < thread_count; ++p)
+		{
+			build.partition_start[p] = accepted;
+			for (t = 0; t < thread_count; ++t)
+			{
+				i = build.cursors[t * thread_count + p];
+				build.cursors[t * thread_count + p] = accepted;
+				accepted += i;
+			}
+		}
+		build.partition_start[thread_count] = accepted;
+
+		HashTable_Build_Run(workers, thread_count, HashTable_Build_Scatter);
+		HashTable_Build_Run(workers, thread_count, HashTable_Build_Size);
+
+		save = arena_save(&hash_table->arena);
+		for (t = 0; ok && t < thread_count; ++t)
+		{
+			workers[t].slice = NULL;
+			if (workers[t].bytes)
+			{
+				workers[t].slice = arena_alloc(&hash_table->arena, workers[t].bytes);
+				ok = workers[t].slice != NULL;
+			}
+		}
+		if (!ok)
+		{
+			arena_restore(&hash_table->arena, save);
+			break;
+		}
+
+		HashTable_Build_Run(workers, thread_count, HashTable_Build_Fill);
+
+		overfull = NULL;
+		for (t = 0; t < thread_count && !overfull; ++t)
+		{
+			if (workers[t].overfull)
+			{
+				overfull = &workers[t];
+			}
+		}
+		if (!overfull)
+		{
+			break;
+		}
+
+		/* skewed bucket, same remedy as Set: twice the buckets, as long as that splits it */
+		ok = HashTable_Bucket_Would_Split(hash_table,
+					&hash_table->buckets.ptr[overfull->overfull_hash % hash_table->buckets.size],
+					overfull->overfull_hash);
+		arena_restore(&hash_table->arena, save);
+		memset(hash_table->buckets.ptr, 0, sizeof(HashTable_Bucket) * hash_table->buckets.size);
+		if (!ok || !HashTable_Build_Resize_Buckets(hash_table, hash_table->buckets.size * 2, &original))
+		{
+			ok = 0;
+			break;
+		}
+	}
+
+	if (ok)
+	{
+		for (t = 0; t < thread_count; ++t)
+		{
+			hash_table->size += workers[t].inserted;
+		}
+	}
+	else
+	{
+		accepted = 0;
+	}
+	HashTable_Build_Release_Buckets(hash_table, &original, ok);
+
+	hash_table->arena.buffer_size = arena_buffer_size;
+	if (thread_scratch.arena)
+	{
+		scratch_end(thread_scratch);
+	}
+
+	return accepted;
+}
+
+#endif /* HT_BUILD_H */
@@ -0,0 +1,158 @@
+#include "bench.h"
+#include "ht_cache.h"
+
+/*
+	read-through cache in front of a pretend backend under zipf distributed
+	gets: every miss loads the key into the cache. prints the hit ratio for
+	a few entry budgets and one byte budget, and checks that the cache
+	stays within them.
+	usage: ht_cache [key_count] [op_count] [zipf_skew]
+*/
+
+#define BUFFER_SIZE (64 * 1024 * 1024)
+static char buffer[BUFFER_SIZE];
+
+#define DEFAULT_KEY_COUNT 1000000
+#define DEFAULT_OP_COUNT 4000000
+#define DEFAULT_ZIPF_SKEW 0.99
+#define MAX_KEY_LENGTH 32
+#define BUCKET_MAX_CAPACITY 48
+#define BUCKET_INITIAL_CAPACITY 4
+
+static size_t budget_permille[] = {10, 50, 100, 250};
+
+/* zipf ranks, rank 0 the hottest */
+static uint32_t *
+ops_generate(size_t key_count, size_t op_count, double skew)
+{
+	double *cdf = malloc(key_count * sizeof(double));
+	uint32_t *ops = malloc(op_count * sizeof(uint32_t));
+	uint64_t rng = rng_seed(0);
+	Zipf zipf;
+	size_t i;
+
+	assert("OOM" && cdf && ops);
+
+	zipf = zipf_init(cdf, key_count, skew);
+	for (i = 0; i < op_count; ++i)
+	{
+		ops[i] = (uint32_t)zipf_next(&zipf, &rng);
+	}
+
+	free(cdf);
+
+	return ops;
+}
+
+/* returns how many sets found a rehash running and left it running */
+static size_t
+run(const char *budget, HashTable_Cache *cache, uint32_t *ops, size_t op_count)
+{
+	char key_buffer[MAX_KEY_LENGTH + 1];
+	uint64_t value, start, elapsed;
+	String8 key;
+	size_t i, peak_size = 0, peak_bytes = 0, sets_mid_rehash = 0;
+	int rehashing;
+
+	key.ptr = key_buffer;
+
+	start = time_now_ns();
+	for (i = 0; i < op_count; ++i)
+	{
+		key.len = snprintf(key_buffer, sizeof(key_buffer), ops[i] % 4 ? "c%u" : "cached_object_%u", ops[i]);
+		if (HashTable_Cache_GetS(cache, key, &value))
+		{
+			assert(value == ops[i]);
+			continue;
+		}
+
+		value = ops[i];
+		rehashing = HashTable_Is_Rehashing(&cache->table);
+		if (!HashTable_Cache_SetS(cache, key, &value))
+		{
+			fprintf(stderr, "could not insert %.*s\n", (int)key.len, key.ptr);
+			exit(1);
+		}
+		sets_mid_rehash += rehashing && HashTable_Is_Rehashing(&cache->table);
+
+		peak_size = cache->table.size > peak_size ? cache->table.size : peak_size;
+		peak_bytes = cache->bytes > peak_bytes ? cache->bytes : peak_bytes;
+	}
+	elapsed = time_now_ns() - start;
+
+	assert(!cache->max_entries || peak_size <= cache->max_entries);
+	assert(!cache->max_bytes || peak_bytes <= cache->max_bytes);
+
+	printf("%-14s %10zu %10zu %8.2f %12zu %10zu %8.2f\n",
+		budget,
+		peak_size,
+		peak_bytes,
+		100.0 * (double)cache->hits / (double)op_count,
+		cache->evictions,
+		cache->table.arena.current_offset,
+		(double)elapsed / (double)op_count);
+
+	return sets_mid_rehash;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t key_count = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : DEFAULT_KEY_COUNT;
+	size_t op_count = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : DEFAULT_OP_COUNT;
+	double skew = argc > 3 ? atof(argv[3]) : DEFAULT_ZIPF_SKEW;
+	HashTable_Cache cache;
+	char budget[32];
+	uint32_t *ops;
+	uint64_t value = 1;
+	size_t i, max_entries;
+
+	ops = ops_generate(key_count, op_count, skew);
+
+	printf("%-14s %10s %10s %8s %12s %10s %8s\n", "budget", "entries", "bytes", "hit%", "evictions", "arena", "ns/op");
+
+	for (i = 0; i < sizeof(budget_permille) / sizeof(budget_permille[0]); ++i)
+	{
+		max_entries = key_count * budget_permille[i] / 1000;
+		cache = HashTable_Cache_Create(max_entries, 0,
+					max_entries / (HASHTABLE_MAX_LOAD_FACTOR / 2) + 1,
+					Wy_Hash,
+					MAX_KEY_LENGTH,
+					sizeof(uint64_t),
+					buffer, BUFFER_SIZE,
+					BUCKET_MAX_CAPACITY,
+					BUCKET_INITIAL_CAPACITY);
+		snprintf(budget, sizeof(budget), "%zu entries", max_entries);
+		run(budget, &cache, ops, op_count);
+		assert(cache.table.grows == 0);
+	}
+
+	/* a byte budget of 5% of the key space at ~20 bytes per entry */
+	cache = HashTable_Cache_Create(0, key_count,
+				key_count / 20 / (HASHTABLE_MAX_LOAD_FACTOR / 2) + 1,
+				Wy_Hash,
+				MAX_KEY_LENGTH,
+				sizeof(uint64_t),
+				buffer, BUFFER_SIZE,
+				BUCKET_MAX_CAPACITY,
+				BUCKET_INITIAL_CAPACITY);
+	snprintf(budget, sizeof(budget), "%zu bytes", key_count);
+	run(budget, &cache, ops, op_count);
+
+	/* a tiny buffer evicts on out of memory rather than failing */
+	cache = HashTable_Cache_Create(0, 0, 16, Wy_Hash, MAX_KEY_LENGTH, sizeof(uint64_t),
+				buffer, 64 * 1024,
+				BUCKET_MAX_CAPACITY,
+				BUCKET_INITIAL_CAPACITY);
+	/* it grows from 16 buckets, each set pays a few rehash steps rather than the whole move */
+	i = run("64 KB buffer", &cache, ops, op_count / 10);
+	assert(cache.table.grows > 0 && i > 0);
+
+	assert(HashTable_Cache_Set(&cache, "removed", &value));
+	assert(HashTable_Cache_Remove(&cache, "removed"));
+	assert(!HashTable_Cache_Get(&cache, "removed", NULL));
+
+	free(ops);
+
+	return 0;
+}
@@ -0,0 +1,329 @@
+#ifndef HT_CACHE_H
+#define HT_CACHE_H
+
+#include "ht_bucket.h"
+
+/*
+	bounded cache on top of HashTable. inserts past the entry or byte budget
+	evict with CLOCK: every entry carries one reference byte stored right
+	after its value, a hit sets it, and the hand sweeps the buckets clearing
+	set bytes and evicting the first entry it finds clear. new entries start
+	clear, so keys seen once go before keys seen twice and a scan over cold
+	keys does not flush the hot ones. while the table grows the hand sweeps
+	the old buckets still waiting to move, from rehash_index on, and then
+	the new array, so sets only pay the usual incremental rehash steps.
+
+	an insert into a bucket already at bucket_max_capacity evicts from that
+	bucket instead of forcing a grow, and an insert that runs the arena out
+	of memory evicts and retries, so the cache never needs more than its
+	buffer. pick initial_bucket_count of at least
+	max_entries / (HASHTABLE_MAX_LOAD_FACTOR / 2) and the table never grows.
+
+	the byte budget counts key bytes plus value_size per entry, the memory
+	the table really uses on top of that is bounded by the buffer.
+*/
+
+typedef struct {
+	HashTable table; /* values are value_size bytes followed by the reference byte */
+	size_t value_size;
+	size_t max_entries; /* 0 for no limit */
+	size_t max_bytes; /* 0 for no limit */
+	size_t bytes;
+
+	size_t hand_bucket;
+	size_t hand_index;
+	int hand_old; /* the hand is in table.rehash_buckets */
+	char *insert_value; /* value_size + 1 bytes to stage an insert */
+
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+} HashTable_Cache;
+
+HashTable_Cache
+HashTable_Cache_Create(size_t max_entries,
+		size_t max_bytes,
+		size_t initial_bucket_count,
+		HashFn hash_fn,
+		size_t max_key_length,
+		size_t value_size,
+		char *buffer, size_t buffer_size,
+		size_t bucket_max_capacity,
+		size_t bucket_initial_capacity)
+{
+	HashTable_Cache cache;
+
+	memset(&cache, 0, sizeof(cache));
+
+	cache.table = HashTable_Create(initial_bucket_count,
+				hash_fn,
+				max_key_length,
+				value_size + 1,
+				buffer, buffer_size,
+				bucket_max_capacity,
+				bucket_initial_capacity);
+	cache.value_size = value_size;
+	cache.max_entries = max_entries;
+	cache.max_bytes = max_bytes;
+
+	cache.insert_value = arena_alloc(&cache.table.arena, value_size + 1);
+	assert(cache.insert_value);
+
+	return cache;
+}
+
+static unsigned char *
+HashTable_Cache_Reference(HashTable_Cache *cache, HashTable_Bucket *bucket, size_t i)
+{
+	return (unsigned char *)nth_no_bounds_checking(bucket->values, i, cache->table.value_size) + cache->value_size;
+}
+
+static void
+HashTable_Cache_Evict_At(HashTable_Cache *cache, HashTable_Bucket *bucket, size_t i)
+{
+	cache->bytes -= HashTable_Key_View(&bucket->keys[i]).len + cache->value_size;
+	HashTable_Bucket_Remove(&cache->table, bucket, i);
+	cache->table.size -= 1;
+	cache->evictions += 1;
+}
+
+/* the bucket under the hand, NULL after moving the hand to the start of the next array */
+static HashTable_Bucket *
+HashTable_Cache_Hand(HashTable_Cache *cache)
+{
+	HashTable *hash_table = &cache->table;
+
+	if (cache->hand_old)
+	{
+		/* buckets below rehash_index have moved, their entries are in the new array */
+		if (cache->hand_bucket < hash_table->rehash_index)
+		{
+			cache->hand_bucket = hash_table->rehash_index;
+			cache->hand_index = 0;
+		}
+		if (HashTable_Is_Rehashing(hash_table) && cache->hand_bucket < hash_table->rehash_buckets.size)
+		{
+			return &hash_table->rehash_buckets.ptr[cache->hand_bucket];
+		}
+		cache->hand_old = 0;
+	}
+	else if (cache->hand_bucket < hash_table->buckets.size)
+	{
+		return &hash_table->buckets.ptr[cache->hand_bucket];
+	}
+	else
+	{
+		cache->hand_old = HashTable_Is_Rehashing(hash_table);
+	}
+
+	cache->hand_bucket = 0;
+	cache->hand_index = 0;
+
+	return NULL;
+}
+
+/* one CLOCK sweep over the whole table, the table must not be empty */
+static void
+HashTable_Cache_Evict(HashTable_Cache *cache)
+{
+	HashTable_Bucket *bucket;
+	unsigned char *reference;
+
+	assert(cache->table.size);
+
+	for (;;)
+	{
+		bucket = HashTable_Cache_Hand(cache);
+		if (!bucket)
+		{
+			continue;
+		}
+
+		if (cache->hand_index >= bucket->size)
+		{
+			cache->hand_bucket += 1;
+			cache->hand_index = 0;
+			continue;
+		}
+
+		reference = HashTable_Cache_Reference(cache, bucket, cache->hand_index);
+		if (*reference)
+		{
+			*reference = 0;
+			cache->hand_index += 1;
+			continue;
+		}
+
+		/* the bucket's last entry moves into hand_index and is looked at next */
+		HashTable_Cache_Evict_At(cache, bucket, cache->hand_index);
+		return;
+	}
+}
+
+/* the same sweep limited to one full bucket */
+static void
+HashTable_Cache_Evict_From(HashTable_Cache *cache, HashTable_Bucket *bucket)
+{
+	unsigned char *reference;
+	size_t i;
+
+	assert(bucket->size);
+
+	for (i = 0; ; i = (i + 1) % bucket->size)
+	{
+		reference = HashTable_Cache_Reference(cache, bucket, i);
+		if (!*reference)
+		{
+			HashTable_Cache_Evict_At(cache, bucket, i);
+			return;
+		}
+		*reference = 0;
+	}
+}
+
+/*
+	inserts or overwrites key, evicting as needed. returns 0 when the key is
+	longer than max_key_length or alone would not fit the byte budget.
+*/
+int
+HashTable_Cache_SetSH(HashTable_Cache *cache, String8 key, size_t hash, void *value)
+{
+	HashTable *hash_table = &cache->table;
+	HashTable_Bucket *bucket;
+	size_t elem_id, bucket_id, charge = key.len + cache->value_size;
+
+	if (key.len > hash_table->max_key_length || (cache->max_bytes && charge > cache->max_bytes))
+	{
+		return 0;
+	}
+
+	bucket = HashTable_Find(hash_table, key, hash, &elem_id);
+	if (bucket)
+	{
+		memcpy(nth_no_bounds_checking(bucket->values, elem_id, hash_table->value_size), value, cache->value_size);
+		*HashTable_Cache_Reference(cache, bucket, elem_id) = 1;
+		return 1;
+	}
+
+	while ((cache->max_entries && hash_table->size >= cache->max_entries) ||
+		(cache->max_bytes && cache->bytes + charge > cache->max_bytes))
+	{
+		HashTable_Cache_Evict(cache);
+	}
+
+	memcpy(cache->insert_value, value, cache->value_size);
+	cache->insert_value[cache->value_size] = 0;
+
+	for (;;)
+	{
+		/* the old bucket feeding the target moves first, so the room made below stays */
+		if (HashTable_Is_Rehashing(hash_table))
+		{
+			bucket_id = hash % hash_table->rehash_buckets.size;
+			bucket = &hash_table->rehash_buckets.ptr[bucket_id];
+			if (bucket_id >= hash_table->rehash_index && !HashTable_Rehash_Bucket(hash_table, bucket))
+			{
+				/* out of memory mid move, the entry that did not fit goes */
+				HashTable_Cache_Evict_At(cache, bucket, bucket->size - 1);
+				continue;
+			}
+		}
+
+		bucket = &hash_table->buckets.ptr[hash % hash_table->buckets.size];
+		if (bucket->size == hash_table->bucket_max_capacity)
+		{
+			HashTable_Cache_Evict_From(cache, bucket);
+		}
+
+		if (HashTable_SetSH(hash_table, key, hash, cache->insert_value))
+		{
+			break;
+		}
+		if (hash_table->size == 0)
+		{
+			return 0;
+		}
+		HashTable_Cache_Evict(cache);
+	}
+	cache->bytes += charge;
+
+	return 1;
+}
+
+int
+HashTable_Cache_GetSH(HashTable_Cache *cache, String8 key, size_t hash, void *out_value)
+{
+	HashTable_Bucket *bucket;
+	size_t elem_id;
+
+	if (key.len > cache->table.max_key_length)
+	{
+		return 0;
+	}
+
+	bucket = HashTable_Find(&cache->table, key, hash, &elem_id);
+	if (!bucket)
+	{
+		cache->misses += 1;
+		return 0;
+	}
+	cache->hits += 1;
+
+	*HashTable_Cache_Reference(cache, bucket, elem_id) = 1;
+	if (out_value)
+	{
+		memcpy(out_value, nth_no_bounds_checking(bucket->values, elem_id, cache->table.value_size), cache->value_size);
+	}
+
+	return 1;
+}
+
+int
+HashTable_Cache_RemoveSH(HashTable_Cache *cache, String8 key, size_t hash)
+{
+	if (!HashTable_RemoveSH(&cache->table, key, hash))
+	{
+		return 0;
+	}
+	cache->bytes -= key.len + cache->value_size;
+
+	return 1;
+}
+
+int
+HashTable_Cache_SetS(HashTable_Cache *cache, String8 key, void *value)
+{
+	return HashTable_Cache_SetSH(cache, key, cache->table.hash_fn(key), value);
+}
+
+int
+HashTable_Cache_GetS(HashTable_Cache *cache, String8 key, void *out_value)
+{
+	return HashTable_Cache_GetSH(cache, key, cache->table.hash_fn(key), out_value);
+}
+
+int
+HashTable_Cache_RemoveS(HashTable_Cache *cache, String8 key)
+{
+	return HashTable_Cache_RemoveSH(cache, key, cache->table.hash_fn(key));
+}
+
+int
+HashTable_Cache_Set(HashTable_Cache *cache, char *key, void *value)
+{
+	return HashTable_Cache_SetS(cache, string8_borrow(key), value);
+}
+
+int
+HashTable_Cache_Get(HashTable_Cache *cache, char *key, void *out_value)
+{
+	return HashTable_Cache_GetS(cache, string8_borrow(key), out_value);
+}
+
+int
+HashTable_Cache_Remove(HashTable_Cache *cache, char *key)
+{
+	return HashTable_Cache_RemoveS(cache, string8_borrow(key));
+}
+
+#endif /* HT_CACHE_H */
@@ -0,0 +1,201 @@
+#ifndef HT_CONCURRENT_H
+#define HT_CONCURRENT_H
+
+#include "ht_bucket.h"
+
+/*
+	HashTable split into independent shards, each a full HashTable with its
+	own slice of the caller buffer and its own reader-writer lock. shard_count
+	must be a power of two, and the shard is the low log2(shard_count) bits
+	of the upper half of the hash, below the tag byte. the bucket index is
+	hash % bucket count, so it only stays clear of the shard bits while the
+	bucket count is a power of two that fits in the lower half.
+
+	readers take the shard lock shared and go through HashTable_PeekSH, which
+	never advances an incremental rehash; writers take it exclusive and drive
+	the rehash as usual. readers on different shards never touch the same
+	cache line, readers on the same shard only share the lock word.
+*/
+
+#define HASHTABLE_CACHE_LINE 64
+
+typedef struct {
+	rwlock_t lock;
+	HashTable table;
+	char pad[HASHTABLE_CACHE_LINE]; /* keeps the next shard's lock off our lines */
+} HashTable_Shard;
+
+typedef struct {
+	HashTable_Shard *shards;
+	size_t shard_count;
+	HashFn hash_fn;
+} HashTable_Concurrent;
+
+/* initial_bucket_count and buffer are split evenly between the shards */
+HashTable_Concurrent
+HashTable_Concurrent_Create(size_t shard_count,
+		size_t initial_bucket_count,
+		HashFn hash_fn,
+		size_t max_key_length,
+		size_t value_size,
+		char *buffer, size_t buffer_size,
+		size_t bucket_max_capacity,
+		size_t bucket_initial_capacity)
+{
+	HashTable_Concurrent concurrent;
+	uintptr_t shards_addr;
+	size_t i, shards_size, shard_buffer_size, shard_bucket_count;
+	char *shard_buffer;
+
+	assert(shard_count && is_power_of_two(shard_count));
+	/* the shard bits must end below the tag byte */
+	assert(shard_count <= ((size_t)1 << (sizeof(size_t) * 4 - 8)));
+	memset(&concurrent, 0, sizeof(concurrent));
+
+	shards_addr = align((uintptr_t)buffer, HASHTABLE_CACHE_LINE);
+	shards_size = shard_count * sizeof(HashTable_Shard);
+	assert(shards_addr - (uintptr_t)buffer + shards_size < buffer_size);
+
+	shard_buffer = (char *)(shards_addr + shards_size);
+	shard_buffer_size = (buffer_size - (size_t)(shard_buffer - buffer)) / shard_count;
+	shard_bucket_count = initial_bucket_count / shard_count;
+	if (shard_bucket_count == 0)
+	{
+		shard_bucket_count = 1;
+	}
+
+	concurrent.shards = (HashTable_Shard *)shards_addr;
+	concurrent.shard_count = shard_count;
+	concurrent.hash_fn = hash_fn;
+
+	for (i = 0; i < shard_count; ++i)
+	{
+		rwlock_init(&concurrent.shards[i].lock);
+		concurrent.shards[i].table = HashTable_Create(shard_bucket_count,
+							hash_fn,
+							max_key_length,
+							value_size,
+							shard_buffer + i * shard_buffer_size,
+							shard_buffer_size,
+							bucket_max_capacity,
+							bucket_initial_capacity);
+	}
+
+	return concurrent;
+}
+
+void
+HashTable_Concurrent_Destroy(HashTable_Concurrent *concurrent)
+{
+	size_t i;
+
+	for (i = 0; i < concurrent->shard_count; ++i)
+	{
+		rwlock_destroy(&concurrent->shards[i].lock);
+	}
+	memset(concurrent, 0, sizeof(*concurrent));
+}
+
+static HashTable_Shard *
+HashTable_Concurrent_Shard(HashTable_Concurrent *concurrent, size_t hash)
+{
+	return &concurrent->shards[(hash >> (sizeof(size_t) * 4)) & (concurrent->shard_count - 1)];
+}
+
+int
+HashTable_Concurrent_SetSH(HashTable_Concurrent *concurrent, String8 key, size_t hash, void *value)
+{
+	HashTable_Shard *shard;
+	int ok;
+
+	shard = HashTable_Concurrent_Shard(concurrent, hash);
+
+	rwlock_wrlock(&shard->lock);
+	ok = HashTable_SetSH(&shard->table, key, hash, value);
+	rwlock_wrunlock(&shard->lock);
+
+	return ok;
+}
+
+int
+HashTable_Concurrent_GetSH(HashTable_Concurrent *concurrent, String8 key, size_t hash, void *out_value)
+{
+	HashTable_Shard *shard;
+	int ok;
+
+	shard = HashTable_Concurrent_Shard(concurrent, hash);
+
+	rwlock_rdlock(&shard->lock);
+	ok = HashTable_PeekSH(&shard->table, key, hash, out_value);
+	rwlock_rdunlock(&shard->lock);
+
+	return ok;
+}
+
+int
+HashTable_Concurrent_RemoveSH(HashTable_Concurrent *concurrent, String8 key, size_t hash)
+{
+	HashTable_Shard *shard;
+	int ok;
+
+	shard = HashTable_Concurrent_Shard(concurrent, hash);
+
+	rwlock_wrlock(&shard->lock);
+	ok = HashTable_RemoveSH(&shard->table, key, hash);
+	rwlock_wrunlock(&shard->lock);
+
+	return ok;
+}
+
+int
+HashTable_Concurrent_SetS(HashTable_Concurrent *concurrent, String8 key, void *value)
+{
+	return HashTable_Concurrent_SetSH(concurrent, key, concurrent->hash_fn(key), value);
+}
+
+int
+HashTable_Concurrent_GetS(HashTable_Concurrent *concurrent, String8 key, void *out_value)
+{
+	return HashTable_Concurrent_GetSH(concurrent, key, concurrent->hash_fn(key), out_value);
+}
+
+int
+HashTable_Concurrent_RemoveS(HashTable_Concurrent *concurrent, String8 key)
+{
+	return HashTable_Concurrent_RemoveSH(concurrent, key, concurrent->hash_fn(key));
+}
+
+int
+HashTable_Concurrent_Set(HashTable_Concurrent *concurrent, char *key, void *value)
+{
+	return HashTable_Concurrent_SetS(concurrent, string8_borrow(key), value);
+}
+
+int
+HashTable_Concurrent_Get(HashTable_Concurrent *concurrent, char *key, void *out_value)
+{
+	return HashTable_Concurrent_GetS(concurrent, string8_borrow(key), out_value);
+}
+
+int
+HashTable_Concurrent_Remove(HashTable_Concurrent *concurrent, char *key)
+{
+	return HashTable_Concurrent_RemoveS(concurrent, string8_borrow(key));
+}
+
+size_t
+HashTable_Concurrent_Size(HashTable_Concurrent *concurrent)
+{
+	size_t i, size = 0;
+
+	for (i = 0; i < concurrent->shard_count; ++i)
+	{
+		rwlock_rdlock(&concurrent->shards[i].lock);
+		size += concurrent->shards[i].table.size;
+		rwlock_rdunlock(&concurrent->shards[i].lock);
+	}
+
+	return size;
+}
+
+#endif /* HT_CONCURRENT_H */
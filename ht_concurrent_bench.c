@@ -0,0 +1,223 @@
+#include "bench.h"
+#include "ht_concurrent.h"
+
+/*
+	throughput of the sharded HashTable_Concurrent against a plain HashTable
+	behind one global mutex, across thread counts and read/write mixes.
+	usage: ht_concurrent_bench [max_threads]
+*/
+
+#define BUFFER_SIZE (128 * 1024 * 1024)
+static char buffer[BUFFER_SIZE];
+
+#define KEY_COUNT (1 << 19)
+#define TOTAL_OPS (1 << 22)
+#define SHARD_COUNT 64
+#define MAX_KEY_LENGTH 8
+#define BUCKET_MAX_CAPACITY 32
+#define BUCKET_INITIAL_CAPACITY 4
+#define MAX_THREADS 256
+
+static char key_buffer[KEY_COUNT][MAX_KEY_LENGTH + 1];
+static String8 keys[KEY_COUNT];
+
+typedef enum {
+	MODE_GLOBAL_MUTEX,
+	MODE_SHARDED,
+} BenchMode;
+
+static struct {
+	BenchMode mode;
+	HashTable table;
+	mutex_t table_lock;
+	HashTable_Concurrent concurrent;
+} bench;
+
+typedef struct {
+	size_t ops;
+	unsigned read_percent;
+	uint64_t rng;
+	size_t found;
+} Worker;
+
+static void *
+worker_run(void *arg)
+{
+	Worker *worker = arg;
+	uint64_t r, value;
+	size_t i;
+	String8 key;
+
+	for (i = 0; i < worker->ops; ++i)
+	{
+		r = xorshift64(&worker->rng);
+		key = keys[(r >> 8) % KEY_COUNT];
+
+		if (r % 100 < worker->read_percent)
+		{
+			if (bench.mode == MODE_SHARDED)
+			{
+				worker->found += HashTable_Concurrent_GetS(&bench.concurrent, key, &value);
+			}
+			else
+			{
+				mutex_lock(&bench.table_lock);
+				worker->found += HashTable_GetS(&bench.table, key, &value);
+				mutex_unlock(&bench.table_lock);
+			}
+		}
+		else
+		{
+			value = r;
+			if (bench.mode == MODE_SHARDED)
+			{
+				HashTable_Concurrent_SetS(&bench.concurrent, key, &value);
+			}
+			else
+			{
+				mutex_lock(&bench.table_lock);
+				HashTable_SetS(&bench.table, key, &value);
+				mutex_unlock(&bench.table_lock);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void
+bench_setup(BenchMode mode)
+{
+	uint64_t value;
+	size_t i;
+	int ok;
+
+	bench.mode = mode;
+	if (mode == MODE_SHARDED)
+	{
+		bench.concurrent = HashTable_Concurrent_Create(SHARD_COUNT,
+						KEY_COUNT / 8,
+						Wy_Hash,
+						MAX_KEY_LENGTH,
+						sizeof(uint64_t),
+						buffer, BUFFER_SIZE,
+						BUCKET_MAX_CAPACITY,
+						BUCKET_INITIAL_CAPACITY);
+	}
+	else
+	{
+		bench.table = HashTable_Create(KEY_COUNT / 8,
+					Wy_Hash,
+					MAX_KEY_LENGTH,
+					sizeof(uint64_t),
+					buffer, BUFFER_SIZE,
+					BUCKET_MAX_CAPACITY,
+					BUCKET_INITIAL_CAPACITY);
+	}
+
+	for (i = 0; i < KEY_COUNT; ++i)
+	{
+		value = i;
+		if (mode == MODE_SHARDED)
+		{
+			ok = HashTable_Concurrent_SetS(&bench.concurrent, keys[i], &value);
+		}
+		else
+		{
+			ok = HashTable_SetS(&bench.table, keys[i], &value);
+		}
+		assert(ok);
+	}
+}
+
+static double
+bench_run(size_t thread_count, unsigned read_percent)
+{
+	static Worker workers[MAX_THREADS];
+	static thread_t threads[MAX_THREADS];
+	uint64_t start;
+	size_t i;
+
+	for (i = 0; i < thread_count; ++i)
+	{
+		memset(&workers[i], 0, sizeof(Worker));
+		workers[i].ops = TOTAL_OPS / thread_count;
+		workers[i].read_percent = read_percent;
+		workers[i].rng = RNG_SEED * (i + 1);
+	}
+
+	start = time_now_ns();
+	for (i = 0; i < thread_count; ++i)
+	{
+		if (!thread_create(&threads[i], worker_run, &workers[i]))
+		{
+			fprintf(stderr, "thread_create failed\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < thread_count; ++i)
+	{
+		thread_join(threads[i]);
+	}
+
+	return (double)(workers[0].ops * thread_count) * 1e3 / (double)(time_now_ns() - start);
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned read_percents[] = {100, 95, 50};
+	static const char *mode_names[] = {"global_mutex", "sharded"};
+	size_t max_threads, thread_count, i, r;
+
+	max_threads = argc > 1 ? (size_t)atoi(argv[1]) : thread_hw_count();
+	if (max_threads == 0 || max_threads > MAX_THREADS)
+	{
+		max_threads = MAX_THREADS;
+	}
+
+	for (i = 0; i < KEY_COUNT; ++i)
+	{
+		keys[i].ptr = key_buffer[i];
+		keys[i].len = snprintf(key_buffer[i], sizeof(key_buffer[i]), "k%zu", i);
+	}
+
+	mutex_init(&bench.table_lock);
+
+	printf("%-14s %8s %8s %12s\n", "mode", "threads", "read%", "Mops/s");
+	for (i = 0; i < 2; ++i)
+	{
+		bench_setup((BenchMode)i);
+
+		for (r = 0; r < sizeof(read_percents) / sizeof(read_percents[0]); ++r)
+		{
+			for (thread_count = 1; ; thread_count *= 2)
+			{
+				if (thread_count > max_threads)
+				{
+					thread_count = max_threads;
+				}
+
+				printf("%-14s %8zu %8u %12.2f\n",
+					mode_names[i],
+					thread_count,
+					read_percents[r],
+					bench_run(thread_count, read_percents[r]));
+
+				if (thread_count == max_threads)
+				{
+					break;
+				}
+			}
+		}
+
+		if (i == MODE_SHARDED)
+		{
+			HashTable_Concurrent_Destroy(&bench.concurrent);
+		}
+	}
+
+	mutex_destroy(&bench.table_lock);
+
+	return 0;
+}
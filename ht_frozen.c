@@ -0,0 +1,141 @@
+#include "ht_frozen.h"
+
+/*
+	builds a table, freezes it and checks every key against the frozen copy.
+	prints lookup times for both next to their memory use.
+	usage: ht_frozen [count]
+*/
+
+#define BUFFER_SIZE (256 * 1024 * 1024)
+static char buffer[BUFFER_SIZE];
+static char frozen_buffer[BUFFER_SIZE];
+
+#define DEFAULT_COUNT 1000000
+#define INITIAL_BUCKET_COUNT 1024
+#define MAX_KEY_LENGTH 32
+#define BUCKET_MAX_CAPACITY 48
+#define BUCKET_INITIAL_CAPACITY 4
+
+/* every third key is long enough to be stored out of line */
+static String8
+key_for(size_t i, char *key_buffer, size_t key_buffer_size)
+{
+	String8 key;
+
+	key.ptr = key_buffer;
+	key.len = snprintf(key_buffer, key_buffer_size, i % 3 ? "f%zu" : "frozen_table_key_%zu", i);
+
+	return key;
+}
+
+static void
+report(const char *table, const char *op, uint64_t elapsed, size_t count)
+{
+	printf("%-8s %-8s %10.2f\n", table, op, (double)elapsed / (double)count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t count = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : DEFAULT_COUNT;
+	HashTable hash_table;
+	HashTable_Frozen frozen;
+	HashTable_Stats stats;
+	String8 *keys;
+	char *key_bytes;
+	uint64_t value, start, sum = 0;
+	size_t i;
+	int ok;
+
+	/* the second half of the keys is never inserted and serves the misses */
+	keys = malloc(2 * count * sizeof(String8));
+	key_bytes = malloc(2 * count * (MAX_KEY_LENGTH + 1));
+	assert("OOM" && keys && key_bytes);
+	for (i = 0; i < 2 * count; ++i)
+	{
+		keys[i] = key_for(i, &key_bytes[i * (MAX_KEY_LENGTH + 1)], MAX_KEY_LENGTH + 1);
+	}
+
+	hash_table = HashTable_Create(INITIAL_BUCKET_COUNT,
+					Wy_Hash,
+					MAX_KEY_LENGTH,
+					sizeof(uint64_t),
+					buffer, BUFFER_SIZE,
+					BUCKET_MAX_CAPACITY,
+					BUCKET_INITIAL_CAPACITY);
+	for (i = 0; i < count; ++i)
+	{
+		value = i * 7;
+		ok = HashTable_SetS(&hash_table, keys[i], &value);
+		assert(ok);
+	}
+
+	start = time_now_ns();
+	ok = HashTable_Freeze(&hash_table, frozen_buffer, BUFFER_SIZE, &frozen);
+	assert(ok);
+	printf("freeze %.2f ms\n", (double)(time_now_ns() - start) / 1e6);
+	assert(frozen.size == hash_table.size);
+
+	for (i = 0; i < 2 * count; ++i)
+	{
+		value = 0;
+		ok = HashTable_Frozen_GetS(&frozen, keys[i], &value);
+		assert(ok == (i < count));
+		assert(!ok || value == i * 7);
+		assert((HashTable_Frozen_IndexSH(&frozen, keys[i], Wy_Hash(keys[i])) < frozen.size) == (i < count));
+	}
+	assert(!HashTable_Frozen_Get(&frozen, "missing", NULL));
+
+	stats = HashTable_Stats_Get(&hash_table);
+	printf("%-8s %-8s %10s\n", "table", "op", "ns/op");
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		HashTable_GetS(&hash_table, keys[i], &value);
+		sum += value;
+	}
+	report("bucket", "get_hit", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = count; i < 2 * count; ++i)
+	{
+		sum += HashTable_GetS(&hash_table, keys[i], NULL);
+	}
+	report("bucket", "get_miss", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		HashTable_Frozen_GetS(&frozen, keys[i], &value);
+		sum += value;
+	}
+	report("frozen", "get_hit", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = count; i < 2 * count; ++i)
+	{
+		sum += HashTable_Frozen_GetS(&frozen, keys[i], NULL);
+	}
+	report("frozen", "get_miss", time_now_ns() - start, count);
+
+	printf("bucket %.1f bytes/key\n", (double)stats.arena_used / (double)count);
+	printf("frozen %.1f bytes/key, %.2f bits/key of hash data\n",
+		(double)HashTable_Frozen_Bytes(&frozen) / (double)count,
+		(double)(frozen.group_count * sizeof(uint16_t) + (frozen.table_size - frozen.size) * sizeof(uint32_t)) * 8 / (double)count);
+
+	/* an empty table freezes too */
+	hash_table = HashTable_Create(INITIAL_BUCKET_COUNT, Wy_Hash, MAX_KEY_LENGTH, sizeof(uint64_t),
+					buffer, BUFFER_SIZE, BUCKET_MAX_CAPACITY, BUCKET_INITIAL_CAPACITY);
+	ok = HashTable_Freeze(&hash_table, frozen_buffer, BUFFER_SIZE, &frozen);
+	assert(ok && frozen.size == 0);
+	assert(!HashTable_Frozen_Get(&frozen, "missing", NULL));
+
+	free(keys);
+	free(key_bytes);
+
+	/* keeps the lookups alive */
+	fprintf(stderr, "sink %llu\n", (unsigned long long)sum);
+
+	return 0;
+}
@@ -0,0 +1,415 @@
+#ifndef HT_FROZEN_H
+#define HT_FROZEN_H
+
+#include "ht_bucket.h"
+
+/*
+	immutable copy of a HashTable behind a minimal perfect hash, built with
+	hash and displace in the style of CHD / PTHash. keys and values sit in
+	dense arrays of exactly size entries, and a lookup is one hash, one pilot
+	load, one key compare:
+
+		x     = hash_mix(hash ^ seed, HASH_P0)
+		group = x * group_count >> 64
+		slot  = hash_mix(x ^ pilots[group] * HASH_P2, HASH_P3) * table_size >> 64
+		slot  = slot < size ? slot : remap[slot - size]
+
+	the build spreads the keys over groups of HASHTABLE_FROZEN_GROUP_LOAD
+	keys on average and, biggest group first, searches the smallest 16 bit
+	pilot that sends every key of the group to a free slot. slots run over
+	size by HASHTABLE_FROZEN_SLACK_PERCENT so the last groups still find free
+	slots quickly, and the few keys that land past size are remapped to the
+	holes left below it. on top of the keys and values that is 16 bits per
+	group plus 32 bits per slack slot, about 4.3 bits per key by default.
+
+	keys keep the 16 byte HashTable_Key slots, out of line keys point into
+	one key bytes block, so HashTable_Key_Eq works on them unchanged.
+*/
+
+/* average keys per group, fewer means more pilots but a quicker search */
+#ifndef HASHTABLE_FROZEN_GROUP_LOAD
+#define HASHTABLE_FROZEN_GROUP_LOAD 4
+#endif
+
+#ifndef HASHTABLE_FROZEN_SLACK_PERCENT
+#define HASHTABLE_FROZEN_SLACK_PERCENT 1
+#endif
+
+/* a group with no pilot up to UINT16_MAX restarts the search with the next seed */
+#ifndef HASHTABLE_FROZEN_ATTEMPTS
+#define HASHTABLE_FROZEN_ATTEMPTS 8
+#endif
+
+typedef struct {
+	Arena arena;
+	HashFn hash_fn;
+	size_t max_key_length;
+	size_t value_size;
+	size_t size;
+	size_t table_size; /* size plus slack, the range the pilots map into */
+	size_t group_count;
+	uint64_t seed;
+
+	uint16_t *pilots;
+	uint32_t *remap; /* table_size - size entries */
+	HashTable_Key *keys;
+	char *values;
+	char *key_bytes;
+	size_t key_bytes_size;
+} HashTable_Frozen;
+
+/* build time record, lives at the end of the arena until the build is done */
+typedef struct {
+	size_t hash;
+	uint64_t x;
+	size_t slot;
+	HashTable_Key *key;
+	void *value;
+} HashTable_Frozen_Entry;
+
+static size_t
+HashTable_Frozen_Reduce(uint64_t x, size_t range)
+{
+	uint64_t r = range;
+
+	hash_mul128(&x, &r);
+
+	return (size_t)r;
+}
+
+static uint64_t
+HashTable_Frozen_X(HashTable_Frozen *frozen, size_t hash)
+{
+	return hash_mix((uint64_t)hash ^ frozen->seed, HASH_P0);
+}
+
+static size_t
+HashTable_Frozen_Slot_For(HashTable_Frozen *frozen, uint64_t x, uint16_t pilot)
+{
+	return HashTable_Frozen_Reduce(hash_mix(x ^ (uint64_t)pilot * HASH_P2, HASH_P3), frozen->table_size);
+}
+
+/* returns 0 when some group finds no pilot, taken then holds a partial placement */
+static int
+HashTable_Frozen_Place(HashTable_Frozen *frozen,
+		HashTable_Frozen_Entry *entries,
+		size_t *order,
+		size_t *group_start,
+		size_t *groups_by_size,
+		unsigned char *taken)
+{
+	HashTable_Frozen_Entry *entry;
+	size_t g, group, first, count, i, j;
+	uint32_t pilot;
+	int ok;
+
+	memset(taken, 0, frozen->table_size);
+
+	for (g = 0; g < frozen->group_count; ++g)
+	{
+		group = groups_by_size[g];
+		first = group_start[group];
+		count = group_start[group + 1] - first;
+		if (count == 0)
+		{
+			break;
+		}
+
+		for (pilot = 0; pilot <= UINT16_MAX; ++pilot)
+		{
+			ok = 1;
+			for (i = 0; ok && i < count; ++i)
+			{
+				entry = &entries[order[first + i]];
+				entry->slot = HashTable_Frozen_Slot_For(frozen, entry->x, (uint16_t)pilot);
+				ok = !taken[entry->slot];
+				for (j = 0; ok && j < i; ++j)
+				{
+					ok = entries[order[first + j]].slot != entry->slot;
+				}
+			}
+			if (ok)
+			{
+				break;
+			}
+		}
+
+		if (pilot > UINT16_MAX)
+		{
+			return 0;
+		}
+
+		frozen->pilots[group] = (uint16_t)pilot;
+		for (i = 0; i < count; ++i)
+		{
+			taken[entries[order[first + i]].slot] = 1;
+		}
+	}
+
+	return 1;
+}
+
+static size_t
+HashTable_Frozen_Collect(HashTable *hash_table, HashTable_Frozen_Entry *entries)
+{
+	HashTable_Bucket *bucket;
+	size_t b, i, n = 0;
+
+	for (b = 0; b < hash_table->buckets.size; ++b)
+	{
+		bucket = &hash_table->buckets.ptr[b];
+		for (i = 0; i < bucket->size; ++i)
+		{
+			entries[n].key = &bucket->keys[i];
+			entries[n].hash = hash_table->hash_fn(HashTable_Key_View(&bucket->keys[i]));
+			entries[n].value = nth_no_bounds_checking(bucket->values, i, hash_table->value_size);
+			n += 1;
+		}
+	}
+
+	return n;
+}
+
+/*
+	copies hash_table into buffer as a HashTable_Frozen, finishing any rehash
+	in progress first. the frozen table does not point into hash_table, which
+	can be destroyed or reused afterwards. lookups use hash_table->hash_fn.
+	the build needs about 60 bytes per key of scratch space at the end of
+	buffer on top of what the frozen table keeps; returns 0 when buffer is too
+	small, when two distinct keys share a full hash, or when the table arena
+	has no room to finish the rehash.
+*/
+int
+HashTable_Freeze(HashTable *hash_table, char *buffer, size_t buffer_size, HashTable_Frozen *out_frozen)
+{
+	HashTable_Frozen frozen;
+	HashTable_Frozen_Entry *entries;
+	HashTable_Key *key;
+	String8 view;
+	size_t *order, *group_start, *groups_by_size, *size_start;
+	size_t n, i, g, slot, hole, max_group, key_bytes_used, attempt;
+	unsigned char *taken;
+	ArenaSave save, scratch;
+	int placed = 0;
+
+	memset(&frozen, 0, sizeof(frozen));
+	if (!HashTable_Rehash_Step(hash_table, SIZE_MAX))
+	{
+		return 0;
+	}
+
+	frozen.arena = arena_init(buffer, buffer_size);
+	frozen.hash_fn = hash_table->hash_fn;
+	frozen.max_key_length = hash_table->max_key_length;
+	frozen.value_size = hash_table->value_size;
+	frozen.size = n = hash_table->size;
+	frozen.table_size = n + n * HASHTABLE_FROZEN_SLACK_PERCENT / 100 + 1;
+	frozen.group_count = n / HASHTABLE_FROZEN_GROUP_LOAD + 1;
+
+	if (n > UINT32_MAX)
+	{
+		return 0;
+	}
+
+	for (i = 0; i < hash_table->buckets.size; ++i)
+	{
+		frozen.key_bytes_size += hash_table->buckets.ptr[i].key_bytes_used - hash_table->buckets.ptr[i].dead_key_bytes;
+	}
+
+	frozen.pilots = arena_alloc(&frozen.arena, frozen.group_count * sizeof(uint16_t));
+	frozen.remap = arena_alloc(&frozen.arena, (frozen.table_size - n) * sizeof(uint32_t));
+	frozen.keys = arena_alloc_aligned(&frozen.arena, n * sizeof(HashTable_Key), 16);
+	frozen.values = arena_alloc_aligned(&frozen.arena, n * frozen.value_size, 16);
+	frozen.key_bytes = arena_alloc(&frozen.arena, frozen.key_bytes_size);
+	if (!frozen.pilots || !frozen.remap || !frozen.keys || !frozen.values || !frozen.key_bytes)
+	{
+		return 0;
+	}
+
+	save = arena_save(&frozen.arena);
+	entries = arena_alloc(&frozen.arena, n * sizeof(HashTable_Frozen_Entry));
+	order = arena_alloc(&frozen.arena, n * sizeof(size_t));
+	group_start = arena_alloc(&frozen.arena, (frozen.group_count + 1) * sizeof(size_t));
+	groups_by_size = arena_alloc(&frozen.arena, frozen.group_count * sizeof(size_t));
+	taken = arena_alloc(&frozen.arena, frozen.table_size);
+	if (!entries || !order || !group_start || !groups_by_size || !taken)
+	{
+		return 0;
+	}
+
+	i = HashTable_Frozen_Collect(hash_table, entries);
+	assert(i == n);
+	scratch = arena_save(&frozen.arena);
+
+	for (attempt = 0; !placed && attempt < HASHTABLE_FROZEN_ATTEMPTS; ++attempt)
+	{
+		frozen.seed = hash_mix(hash_seed ^ attempt, HASH_P1);
+
+		/* counting sort of the entries by group, then of the groups by size, biggest first */
+		memset(group_start, 0, (frozen.group_count + 1) * sizeof(size_t));
+		for (i = 0; i < n; ++i)
+		{
+			entries[i].x = HashTable_Frozen_X(&frozen, entries[i].hash);
+			group_start[HashTable_Frozen_Reduce(entries[i].x, frozen.group_count) + 1] += 1;
+		}
+		max_group = 0;
+		for (g = 0; g < frozen.group_count; ++g)
+		{
+			max_group = group_start[g + 1] > max_group ? group_start[g + 1] : max_group;
+			group_start[g + 1] += group_start[g];
+		}
+		for (i = 0; i < n; ++i)
+		{
+			order[group_start[HashTable_Frozen_Reduce(entries[i].x, frozen.group_count)]++] = i;
+		}
+		for (g = frozen.group_count; g > 0; --g)
+		{
+			group_start[g] = group_start[g - 1];
+		}
+		group_start[0] = 0;
+
+		size_start = arena_alloc(&frozen.arena, (max_group + 2) * sizeof(size_t));
+		if (!size_start)
+		{
+			arena_restore(&frozen.arena, save);
+			return 0;
+		}
+		for (g = 0; g < frozen.group_count; ++g)
+		{
+			size_start[max_group - (group_start[g + 1] - group_start[g]) + 1] += 1;
+		}
+		for (i = 0; i <= max_group; ++i)
+		{
+			size_start[i + 1] += size_start[i];
+		}
+		for (g = 0; g < frozen.group_count; ++g)
+		{
+			groups_by_size[size_start[max_group - (group_start[g + 1] - group_start[g])]++] = g;
+		}
+
+		/* two keys with the same x always collide, no seed can tell them apart */
+		for (g = 0; g < frozen.group_count; ++g)
+		{
+			for (i = group_start[g]; i < group_start[g + 1]; ++i)
+			{
+				for (slot = group_start[g]; slot < i; ++slot)
+				{
+					if (entries[order[i]].x == entries[order[slot]].x)
+					{
+						arena_restore(&frozen.arena, save);
+						return 0;
+					}
+				}
+			}
+		}
+
+		placed = HashTable_Frozen_Place(&frozen, entries, order, group_start, groups_by_size, taken);
+		arena_restore(&frozen.arena, scratch);
+	}
+
+	if (!placed)
+	{
+		arena_restore(&frozen.arena, save);
+		return 0;
+	}
+
+	/* pair every taken slot past size with a hole below it */
+	hole = 0;
+	for (slot = n; slot < frozen.table_size; ++slot)
+	{
+		if (taken[slot])
+		{
+			while (taken[hole])
+			{
+				hole += 1;
+			}
+			assert(hole < n);
+			frozen.remap[slot - n] = (uint32_t)hole;
+			taken[hole] = 1;
+		}
+	}
+
+	key_bytes_used = 0;
+	for (i = 0; i < n; ++i)
+	{
+		slot = entries[i].slot < n ? entries[i].slot : frozen.remap[entries[i].slot - n];
+		key = &frozen.keys[slot];
+		*key = *entries[i].key;
+		if (key->len == HASHTABLE_KEY_OUT_OF_LINE)
+		{
+			view = HashTable_Key_View(key);
+			memcpy(frozen.key_bytes + key_bytes_used, view.ptr, view.len);
+			HashTable_Key_Set_Out_Of_Line(key, frozen.key_bytes + key_bytes_used, view.len);
+			key_bytes_used += view.len;
+		}
+		memcpy(nth_no_bounds_checking(frozen.values, slot, frozen.value_size), entries[i].value, frozen.value_size);
+	}
+	assert(key_bytes_used <= frozen.key_bytes_size);
+
+	/* drop the scratch space, the buffer past the frozen arrays is free again */
+	arena_restore(&frozen.arena, save);
+	*out_frozen = frozen;
+
+	return 1;
+}
+
+/* bytes of buffer the frozen table keeps */
+size_t
+HashTable_Frozen_Bytes(HashTable_Frozen *frozen)
+{
+	return frozen->arena.current_offset;
+}
+
+/* the dense index of key in [0, size), or size when key is not in the table */
+size_t
+HashTable_Frozen_IndexSH(HashTable_Frozen *frozen, String8 key, size_t hash)
+{
+	uint64_t x;
+	size_t slot;
+
+	if (frozen->size == 0 || key.len > frozen->max_key_length)
+	{
+		return frozen->size;
+	}
+
+	x = HashTable_Frozen_X(frozen, hash);
+	slot = HashTable_Frozen_Slot_For(frozen, x, frozen->pilots[HashTable_Frozen_Reduce(x, frozen->group_count)]);
+	if (slot >= frozen->size)
+	{
+		slot = frozen->remap[slot - frozen->size];
+	}
+
+	return HashTable_Key_Eq(&frozen->keys[slot], key) ? slot : frozen->size;
+}
+
+int
+HashTable_Frozen_GetSH(HashTable_Frozen *frozen, String8 key, size_t hash, void *out_value)
+{
+	size_t slot = HashTable_Frozen_IndexSH(frozen, key, hash);
+
+	if (slot == frozen->size)
+	{
+		return 0;
+	}
+
+	if (out_value)
+	{
+		memcpy(out_value, nth_no_bounds_checking(frozen->values, slot, frozen->value_size), frozen->value_size);
+	}
+
+	return 1;
+}
+
+int
+HashTable_Frozen_GetS(HashTable_Frozen *frozen, String8 key, void *out_value)
+{
+	return HashTable_Frozen_GetSH(frozen, key, frozen->hash_fn(key), out_value);
+}
+
+int
+HashTable_Frozen_Get(HashTable_Frozen *frozen, char *key, void *out_value)
+{
+	return HashTable_Frozen_GetS(frozen, string8_borrow(key), out_value);
+}
+
+#endif /* HT_FROZEN_H */
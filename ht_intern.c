@@ -0,0 +1,190 @@
+#include "bench.h"
+#include "ht_intern.h"
+
+/*
+	interns a tokenized stream of words one token at a time, in bulk, and
+	from several threads at once, and checks that every path hands out the
+	same ids. prints ns per token and the cost of comparing tokens by
+	String8Eq against comparing their ids.
+	usage: ht_intern [threads] [token_count]
+*/
+
+#define TABLE_BUFFER_SIZE (64 * 1024 * 1024)
+#define STRINGS_BUFFER_SIZE (64 * 1024 * 1024)
+static char table_buffer[TABLE_BUFFER_SIZE];
+static char strings_buffer[STRINGS_BUFFER_SIZE];
+
+#define DEFAULT_TOKEN_COUNT 2000000
+#define VOCABULARY 100000
+#define MAX_STRINGS (2 * VOCABULARY)
+#define MAX_WORD_LENGTH 32
+#define INITIAL_BUCKET_COUNT 1024
+#define BUCKET_MAX_CAPACITY 48
+#define BUCKET_INITIAL_CAPACITY 4
+#define MAX_THREADS 64
+
+typedef struct {
+	HashTable_Intern *intern;
+	String8 *tokens;
+	size_t count;
+	uint32_t *ids;
+} Worker;
+
+static void
+intern_create(HashTable_Intern *intern)
+{
+	HashTable_Intern_Create(intern,
+				MAX_STRINGS,
+				INITIAL_BUCKET_COUNT,
+				Wy_Hash,
+				MAX_WORD_LENGTH,
+				table_buffer, TABLE_BUFFER_SIZE,
+				strings_buffer, STRINGS_BUFFER_SIZE,
+				BUCKET_MAX_CAPACITY,
+				BUCKET_INITIAL_CAPACITY);
+}
+
+static void *
+worker_run(void *arg)
+{
+	Worker *worker = arg;
+	size_t i;
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		worker->ids[i] = HashTable_InternS(worker->intern, worker->tokens[i]);
+	}
+
+	return NULL;
+}
+
+static void
+report(const char *op, uint64_t elapsed, size_t count)
+{
+	printf("%-12s %10.2f\n", op, (double)elapsed / (double)count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t thread_count = argc > 1 ? (size_t)atoi(argv[1]) : thread_hw_count();
+	size_t count = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : DEFAULT_TOKEN_COUNT;
+	HashTable_Intern intern;
+	Worker workers[MAX_THREADS];
+	thread_t threads[MAX_THREADS];
+	String8 *tokens, canonical;
+	uint32_t *ids, *bulk_ids, *thread_ids;
+	uint64_t rng = rng_seed(0), start, r;
+	char *text;
+	size_t i, t, word, equal = 0;
+
+	if (thread_count == 0 || thread_count > MAX_THREADS)
+	{
+		thread_count = MAX_THREADS;
+	}
+
+	/* skewed word choice, small words far more common than large ones */
+	tokens = malloc(count * sizeof(String8));
+	text = malloc(count * (MAX_WORD_LENGTH + 1));
+	ids = malloc(count * sizeof(uint32_t));
+	bulk_ids = malloc(count * sizeof(uint32_t));
+	thread_ids = malloc(thread_count * count * sizeof(uint32_t));
+	assert("OOM" && tokens && text && ids && bulk_ids && thread_ids);
+	for (i = 0; i < count; ++i)
+	{
+		r = xorshift64(&rng) % VOCABULARY;
+		word = (size_t)(r * r / VOCABULARY);
+		tokens[i].ptr = &text[i * (MAX_WORD_LENGTH + 1)];
+		tokens[i].len = snprintf(tokens[i].ptr, MAX_WORD_LENGTH + 1, word % 5 ? "w%zu" : "longer_token_%zu", word);
+	}
+
+	printf("%-12s %10s\n", "op", "ns/token");
+
+	intern_create(&intern);
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		ids[i] = HashTable_InternS(&intern, tokens[i]);
+	}
+	report("intern", time_now_ns() - start, count);
+
+	for (i = 0; i < count; ++i)
+	{
+		assert(ids[i] != HASHTABLE_INTERN_NONE);
+		canonical = HashTable_Intern_String(&intern, ids[i]);
+		assert(String8Eq(canonical, tokens[i]));
+		assert(HashTable_Intern_FindS(&intern, tokens[i]) == ids[i]);
+	}
+	assert(HashTable_Intern_FindS(&intern, string8_borrow("never seen")) == HASHTABLE_INTERN_NONE);
+	HashTable_Intern_Destroy(&intern);
+
+	intern_create(&intern);
+	start = time_now_ns();
+	assert(HashTable_Intern_Bulk(&intern, tokens, count, bulk_ids) == count);
+	report("bulk", time_now_ns() - start, count);
+
+	/* first come first numbered, so bulk and one at a time agree */
+	assert(memcmp(ids, bulk_ids, count * sizeof(uint32_t)) == 0);
+	HashTable_Intern_Destroy(&intern);
+
+	intern_create(&intern);
+	start = time_now_ns();
+	for (t = 0; t < thread_count; ++t)
+	{
+		workers[t].intern = &intern;
+		workers[t].tokens = tokens;
+		workers[t].count = count;
+		workers[t].ids = &thread_ids[t * count];
+		if (!thread_create(&threads[t], worker_run, &workers[t]))
+		{
+			fprintf(stderr, "thread_create failed\n");
+			return 1;
+		}
+	}
+	for (t = 0; t < thread_count; ++t)
+	{
+		thread_join(threads[t]);
+	}
+	report("threads", time_now_ns() - start, thread_count * count);
+
+	/* the numbering depends on the interleaving, but every thread sees the same one */
+	for (t = 1; t < thread_count; ++t)
+	{
+		assert(memcmp(thread_ids, &thread_ids[t * count], count * sizeof(uint32_t)) == 0);
+	}
+	for (i = 0; i < count; ++i)
+	{
+		assert(String8Eq(HashTable_Intern_String(&intern, thread_ids[i]), tokens[i]));
+	}
+
+	start = time_now_ns();
+	for (i = 1; i < count; ++i)
+	{
+		equal += String8Eq(tokens[i], tokens[i - 1]);
+	}
+	report("eq_string", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = 1; i < count; ++i)
+	{
+		equal -= ids[i] == ids[i - 1];
+	}
+	report("eq_id", time_now_ns() - start, count);
+	assert(equal == 0);
+
+	printf("%zu tokens, %zu distinct, %zu string bytes\n", count, intern.count, intern.arena.current_offset);
+#ifdef ARENA_DEBUG
+	/* what TABLE_BUFFER_SIZE and STRINGS_BUFFER_SIZE need to be */
+	arena_report(stdout, &intern.table.arena);
+	arena_report(stdout, &intern.arena);
+#endif
+	HashTable_Intern_Destroy(&intern);
+
+	free(tokens);
+	free(text);
+	free(ids);
+	free(bulk_ids);
+	free(thread_ids);
+
+	return 0;
+}
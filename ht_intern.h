@@ -0,0 +1,203 @@
+#ifndef HT_INTERN_H
+#define HT_INTERN_H
+
+#include "ht_bucket.h"
+
+/*
+	string interning on top of HashTable: every distinct string gets a dense
+	32 bit id and one canonical copy, so two interned strings are equal
+	exactly when their ids (or canonical pointers) are, and tables further
+	down can be keyed by the id.
+
+	the table maps string -> id, the canonical copies and the id -> string
+	array live in a second arena that only ever grows, so canonical pointers
+	stay valid for the life of the interner. interning takes the lock
+	shared for the lookup and exclusive only to add a new string.
+	HashTable_Intern_String needs no lock: an id is only handed out after
+	its slot is written, under the lock.
+*/
+
+#define HASHTABLE_INTERN_NONE UINT32_MAX
+
+typedef struct {
+	rwlock_t lock;
+	HashTable table; /* string -> uint32_t id */
+	Arena arena; /* canonical bytes */
+	String8 *strings; /* id -> canonical string */
+	size_t count;
+	size_t capacity;
+} HashTable_Intern;
+
+/*
+	table_buffer backs the string -> id table, strings_buffer the id array
+	(max_strings String8s) and the canonical bytes. intern is set up in
+	place, the lock must not be copied once initialized.
+*/
+void
+HashTable_Intern_Create(HashTable_Intern *intern,
+		size_t max_strings,
+		size_t initial_bucket_count,
+		HashFn hash_fn,
+		size_t max_string_length,
+		char *table_buffer, size_t table_buffer_size,
+		char *strings_buffer, size_t strings_buffer_size,
+		size_t bucket_max_capacity,
+		size_t bucket_initial_capacity)
+{
+	assert(max_strings && max_strings <= HASHTABLE_INTERN_NONE);
+	memset(intern, 0, sizeof(*intern));
+
+	rwlock_init(&intern->lock);
+	intern->table = HashTable_Create(initial_bucket_count,
+				hash_fn,
+				max_string_length,
+				sizeof(uint32_t),
+				table_buffer, table_buffer_size,
+				bucket_max_capacity,
+				bucket_initial_capacity);
+
+	intern->arena = arena_init(strings_buffer, strings_buffer_size);
+	intern->strings = arena_alloc(&intern->arena, max_strings * sizeof(String8));
+	assert(intern->strings);
+	intern->capacity = max_strings;
+}
+
+void
+HashTable_Intern_Destroy(HashTable_Intern *intern)
+{
+	rwlock_destroy(&intern->lock);
+	memset(intern, 0, sizeof(*intern));
+}
+
+/* caller holds the lock exclusive and checked that string is absent */
+static uint32_t
+HashTable_Intern_Add(HashTable_Intern *intern, String8 string, size_t hash)
+{
+	ArenaSave save;
+	String8 canonical;
+	uint32_t id;
+
+	if (intern->count == intern->capacity)
+	{
+		return HASHTABLE_INTERN_NONE;
+	}
+
+	save = arena_save(&intern->arena);
+	canonical.ptr = arena_alloc_aligned_nozero(&intern->arena, string.len, 1);
+	canonical.len = string.len;
+	if (!canonical.ptr)
+	{
+		return HASHTABLE_INTERN_NONE;
+	}
+	memcpy(canonical.ptr, string.ptr, string.len);
+
+	id = (uint32_t)intern->count;
+	if (!HashTable_SetSH(&intern->table, canonical, hash, &id))
+	{
+		arena_restore(&intern->arena, save);
+		return HASHTABLE_INTERN_NONE;
+	}
+
+	intern->strings[id] = canonical;
+	intern->count += 1;
+
+	return id;
+}
+
+/* id of string, HASHTABLE_INTERN_NONE when it was never interned */
+uint32_t
+HashTable_Intern_FindSH(HashTable_Intern *intern, String8 string, size_t hash)
+{
+	uint32_t id = HASHTABLE_INTERN_NONE;
+
+	rwlock_rdlock(&intern->lock);
+	HashTable_PeekSH(&intern->table, string, hash, &id);
+	rwlock_rdunlock(&intern->lock);
+
+	return id;
+}
+
+/*
+	id of string, adding it first when it is new. returns
+	HASHTABLE_INTERN_NONE when the string is longer than max_string_length
+	or the interner is out of ids or memory.
+*/
+uint32_t
+HashTable_InternSH(HashTable_Intern *intern, String8 string, size_t hash)
+{
+	uint32_t id = HashTable_Intern_FindSH(intern, string, hash);
+
+	if (id != HASHTABLE_INTERN_NONE || string.len > intern->table.max_key_length)
+	{
+		return id;
+	}
+
+	/* another thread may have added it between the two locks */
+	rwlock_wrlock(&intern->lock);
+	if (!HashTable_PeekSH(&intern->table, string, hash, &id))
+	{
+		id = HashTable_Intern_Add(intern, string, hash);
+	}
+	rwlock_wrunlock(&intern->lock);
+
+	return id;
+}
+
+uint32_t
+HashTable_InternS(HashTable_Intern *intern, String8 string)
+{
+	return HashTable_InternSH(intern, string, intern->table.hash_fn(string));
+}
+
+uint32_t
+HashTable_Intern_FindS(HashTable_Intern *intern, String8 string)
+{
+	return HashTable_Intern_FindSH(intern, string, intern->table.hash_fn(string));
+}
+
+/*
+	interns n strings, typically the tokens of one input, under a single
+	exclusive lock with the lookups of each HASHTABLE_BATCH_GROUP strings
+	prefetched together. out_ids receives one id per string (NONE for the
+	ones that could not be added), returns the number of strings interned.
+*/
+size_t
+HashTable_Intern_Bulk(HashTable_Intern *intern, String8 *strings, size_t n, uint32_t *out_ids)
+{
+	size_t hashes[HASHTABLE_BATCH_GROUP];
+	size_t base, group, i, interned = 0;
+	uint32_t id;
+
+	rwlock_wrlock(&intern->lock);
+	for (base = 0; base < n; base += group)
+	{
+		group = n - base < HASHTABLE_BATCH_GROUP ? n - base : HASHTABLE_BATCH_GROUP;
+		HashTable_Prefetch_Group(&intern->table, &strings[base], hashes, group);
+
+		for (i = 0; i < group; ++i)
+		{
+			id = HASHTABLE_INTERN_NONE;
+			if (strings[base + i].len <= intern->table.max_key_length &&
+				!HashTable_GetSH(&intern->table, strings[base + i], hashes[i], &id))
+			{
+				id = HashTable_Intern_Add(intern, strings[base + i], hashes[i]);
+			}
+			out_ids[base + i] = id;
+			interned += id != HASHTABLE_INTERN_NONE;
+		}
+	}
+	rwlock_wrunlock(&intern->lock);
+
+	return interned;
+}
+
+/* canonical copy of an interned string, valid for the life of the interner */
+String8
+HashTable_Intern_String(HashTable_Intern *intern, uint32_t id)
+{
+	assert(id < intern->count);
+
+	return intern->strings[id];
+}
+
+#endif /* HT_INTERN_H */
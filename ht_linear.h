@@ -0,0 +1,552 @@
+#ifndef HT_LINEAR_H
+#define HT_LINEAR_H
+
+#include "v.h"
+
+/*
+	open addressing table with fixed size keys and values, allocated with
+	malloc. named LinearHashTable so it can share a program with ht_bucket.h.
+*/
+
+typedef size_t (*LinearHashFn)(char *key, size_t key_size);
+
+size_t fnv1a(char *key, size_t key_size) {
+	size_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < key_size; ++i) {
+		hash ^= (unsigned char)key[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+size_t wyhash(char *key, size_t key_size) {
+	return (size_t)hash_wy(key, key_size, hash_seed);
+}
+
+/*
+	swiss table style layout: every slot has a control byte which is either
+	HT_CTRL_EMPTY, HT_CTRL_DELETED or the low 7 bits of the key hash (h2). probing walks whole
+	groups of HT_GROUP_WIDTH control bytes, matching h2 against the group with
+	a single simd compare; keys are only touched for control byte matches.
+	the high bits of the hash (h1) pick the starting group.
+*/
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define HT_GROUP_WIDTH 32
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define HT_SSE2
+	#define HT_GROUP_WIDTH 16
+#else
+	#define HT_GROUP_WIDTH 16
+#endif
+
+#define HT_CTRL_EMPTY ((signed char)-128)
+#define HT_CTRL_DELETED ((signed char)-2) /* tombstone, probing continues past it */
+#define HT_H1(hash) ((hash) >> 7)
+#define HT_H2(hash) ((signed char)((hash) & 0x7f))
+
+/* max load factor 7/8 */
+#define HT_MAX_LOAD(capacity) ((capacity) - (capacity) / 8)
+
+typedef unsigned int ht_mask;
+
+static ht_mask ht_group_match(signed char *group, signed char ctrl) {
+#if defined(__AVX2__)
+	__m256i g = _mm256_loadu_si256((__m256i *)group);
+	return (ht_mask)_mm256_movemask_epi8(_mm256_cmpeq_epi8(g, _mm256_set1_epi8(ctrl)));
+#elif defined(HT_SSE2)
+	__m128i g = _mm_loadu_si128((__m128i *)group);
+	return (ht_mask)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(ctrl)));
+#else
+	ht_mask mask = 0;
+	for (int i = 0; i < HT_GROUP_WIDTH; ++i) {
+		mask |= (ht_mask)(group[i] == ctrl) << i;
+	}
+	return mask;
+#endif
+}
+
+/* empty or deleted slots, both have the sign bit set */
+static ht_mask ht_group_match_free(signed char *group) {
+#if defined(__AVX2__)
+	return (ht_mask)_mm256_movemask_epi8(_mm256_loadu_si256((__m256i *)group));
+#elif defined(HT_SSE2)
+	return (ht_mask)_mm_movemask_epi8(_mm_loadu_si128((__m128i *)group));
+#else
+	ht_mask mask = 0;
+	for (int i = 0; i < HT_GROUP_WIDTH; ++i) {
+		mask |= (ht_mask)(group[i] < 0) << i;
+	}
+	return mask;
+#endif
+}
+
+static int ht_mask_next(ht_mask *mask) {
+	int i;
+	assert(*mask);
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long idx;
+	_BitScanForward(&idx, *mask);
+	i = (int)idx;
+#else
+	i = __builtin_ctz(*mask);
+#endif
+	*mask &= *mask - 1;
+	return i;
+}
+
+typedef struct {
+	signed char *ctrl;
+	void *keys;
+	void *values;
+	size_t key_size;
+	size_t value_size;
+	size_t size; /* number of live entries */
+	size_t deleted; /* number of tombstones */
+	size_t capacity; /* number of slots, power of two multiple of HT_GROUP_WIDTH */
+	LinearHashFn hash;
+} LinearHashTable;
+
+static size_t ht_capacity_for(size_t count) {
+	size_t capacity = HT_GROUP_WIDTH;
+	while (HT_MAX_LOAD(capacity) < count) {
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+static void ht_alloc_slots(LinearHashTable *ht, size_t capacity) {
+	ht->ctrl = malloc(capacity);
+	assert("OOM" && ht->ctrl);
+	memset(ht->ctrl, HT_CTRL_EMPTY, capacity);
+
+	ht->keys = malloc(ht->key_size * capacity);
+	assert("OOM" && ht->keys);
+
+	ht->values = malloc(ht->value_size * capacity);
+	assert("OOM" && ht->values);
+
+	ht->capacity = capacity;
+	ht->size = 0;
+	ht->deleted = 0;
+}
+
+LinearHashTable ht_create(size_t key_size, size_t value_size, size_t max_size_estimate, LinearHashFn hash) {
+	LinearHashTable ht;
+
+	assert(key_size && value_size && hash);
+	memset(&ht, 0, sizeof(ht));
+	ht.key_size = key_size;
+	ht.value_size = value_size;
+	ht.hash = hash;
+	ht_alloc_slots(&ht, ht_capacity_for(max_size_estimate));
+
+	return ht;
+}
+
+void ht_destroy(LinearHashTable *ht) {
+	assert(ht && ht->capacity && ht->ctrl && ht->keys && ht->values);
+	free(ht->ctrl);
+	free(ht->keys);
+	free(ht->values);
+	memset(ht, 0, sizeof(*ht));
+}
+
+void *ht_nth_key(LinearHashTable *ht, size_t n) {
+	return (char *)ht->keys + n * ht->key_size;
+}
+
+void *ht_nth_value(LinearHashTable *ht, size_t n) {
+	return (char *)ht->values + n * ht->value_size;
+}
+
+/* bytes held by the slot arrays, a rehash briefly holds the old ones too */
+size_t ht_bytes(LinearHashTable *ht) {
+	return ht->capacity * (1 + ht->key_size + ht->value_size);
+}
+
+/*
+	triangular probing over groups, visits every group exactly once
+	because the group count is a power of two.
+	returns the slot holding key, or ht->capacity when it is missing.
+	*out_empty receives the first empty or deleted slot on the probe sequence.
+*/
+static size_t ht_find(LinearHashTable *ht, void *key, size_t hash, size_t *out_empty) {
+	size_t group_mask = ht->capacity / HT_GROUP_WIDTH - 1;
+	size_t g = HT_H1(hash) & group_mask;
+	signed char h2 = HT_H2(hash);
+	size_t step, base, slot;
+	signed char *group;
+	ht_mask match;
+	int free_found = 0;
+
+	for (step = 1; step <= group_mask + 1; ++step) {
+		base = g * HT_GROUP_WIDTH;
+		group = ht->ctrl + base;
+
+		match = ht_group_match(group, h2);
+		while (match) {
+			slot = base + ht_mask_next(&match);
+			if (memcmp(ht_nth_key(ht, slot), key, ht->key_size) == 0) {
+				return slot;
+			}
+		}
+
+		if (out_empty && !free_found) {
+			match = ht_group_match_free(group);
+			if (match) {
+				*out_empty = base + ht_mask_next(&match);
+				free_found = 1;
+			}
+		}
+
+		if (ht_group_match(group, HT_CTRL_EMPTY)) {
+			return ht->capacity;
+		}
+
+		g = (g + step) & group_mask;
+	}
+
+	/* unreachable while the load factor stays below 1 */
+	assert(0);
+	return ht->capacity;
+}
+
+/* first empty slot on the probe sequence of hash, used for keys known to be absent */
+static size_t ht_find_empty(LinearHashTable *ht, size_t hash) {
+	size_t group_mask = ht->capacity / HT_GROUP_WIDTH - 1;
+	size_t g = HT_H1(hash) & group_mask;
+	size_t step;
+	ht_mask match;
+
+	for (step = 1; step <= group_mask + 1; ++step) {
+		match = ht_group_match(ht->ctrl + g * HT_GROUP_WIDTH, HT_CTRL_EMPTY);
+		if (match) {
+			return g * HT_GROUP_WIDTH + ht_mask_next(&match);
+		}
+		g = (g + step) & group_mask;
+	}
+
+	assert(0);
+	return ht->capacity;
+}
+
+static void ht_put_slot(LinearHashTable *ht, size_t slot, size_t hash, void *key, void *value) {
+	ht->ctrl[slot] = HT_H2(hash);
+	memcpy(ht_nth_key(ht, slot), key, ht->key_size);
+	memcpy(ht_nth_value(ht, slot), value, ht->value_size);
+	ht->size += 1;
+}
+
+static void ht_rehash(LinearHashTable *ht, size_t new_capacity) {
+	LinearHashTable old = *ht;
+	size_t i, hash;
+
+	ht_alloc_slots(ht, new_capacity);
+
+	for (i = 0; i < old.capacity; ++i) {
+		if (old.ctrl[i] < 0) continue;
+		hash = ht->hash(ht_nth_key(&old, i), ht->key_size);
+		ht_put_slot(ht, ht_find_empty(ht, hash), hash, ht_nth_key(&old, i), ht_nth_value(&old, i));
+	}
+
+	ht_destroy(&old);
+}
+
+void ht_set(LinearHashTable *ht, void *key, void *value) {
+	size_t hash = ht->hash(key, ht->key_size);
+	size_t slot, empty = 0;
+
+	slot = ht_find(ht, key, hash, &empty);
+	if (slot != ht->capacity) {
+		memcpy(ht_nth_value(ht, slot), value, ht->value_size);
+		return;
+	}
+
+	if (ht->ctrl[empty] == HT_CTRL_DELETED) {
+		ht->deleted -= 1;
+	} else if (ht->size + ht->deleted + 1 > HT_MAX_LOAD(ht->capacity)) {
+		/* mostly tombstones: rehash in place to clear them instead of growing */
+		ht_rehash(ht, ht->size + 1 > HT_MAX_LOAD(ht->capacity) / 2 ? ht->capacity * 2 : ht->capacity);
+		empty = ht_find_empty(ht, hash);
+	}
+
+	/* the table owns copies of key & value */
+	ht_put_slot(ht, empty, hash, key, value);
+}
+
+int ht_remove(LinearHashTable *ht, void *key) {
+	size_t slot = ht_find(ht, key, ht->hash(key, ht->key_size), NULL);
+	size_t base;
+
+	if (slot == ht->capacity) {
+		return 0;
+	}
+
+	/*
+		probing only moves past full groups, and a group never gets an empty
+		slot back until the next rehash. so if this group still has one, no
+		probe sequence continues past it and the slot can be emptied.
+	*/
+	base = slot / HT_GROUP_WIDTH * HT_GROUP_WIDTH;
+	if (ht_group_match(ht->ctrl + base, HT_CTRL_EMPTY)) {
+		ht->ctrl[slot] = HT_CTRL_EMPTY;
+	} else {
+		ht->ctrl[slot] = HT_CTRL_DELETED;
+		ht->deleted += 1;
+	}
+	ht->size -= 1;
+
+	return 1;
+}
+
+void *ht_get(LinearHashTable *ht, void *key) {
+	size_t slot = ht_find(ht, key, ht->hash(key, ht->key_size), NULL);
+
+	if (slot == ht->capacity) {
+		return NULL;
+	}
+
+	return ht_nth_value(ht, slot);
+}
+
+/*
+	integer keyed variant for uint64_t keys, uint32_t ids widen into them.
+	there are no control bytes: an empty slot holds HT_INT_EMPTY_KEY and the
+	one key equal to it lives in a side slot. keys and values are separate
+	arrays, so a probe compares HT_INT_GROUP keys at once straight from the
+	key array.
+	the hash is a single multiply whose top bits pick the home group
+	(fibonacci hashing). inserts take the first empty slot from the start of
+	the home group on, and removes shift later keys back into the hole
+	instead of leaving tombstones, so a lookup stops at the first group with
+	an empty slot.
+*/
+#define HT_INT_EMPTY_KEY UINT64_MAX
+#define HT_INT_GROUP 4
+#define HT_INT_MUL 0x9e3779b97f4a7c15ULL
+
+/* linear probing wants more headroom than the group probing above, max load factor 3/4 */
+#define HT_INT_MAX_LOAD(capacity) ((capacity) / 2 + (capacity) / 4)
+
+typedef struct {
+	uint64_t *keys;
+	void *values;
+	void *empty_key_value; /* value of HT_INT_EMPTY_KEY when has_empty_key */
+	int has_empty_key;
+	size_t value_size;
+	size_t size; /* number of live entries, the side slot included */
+	size_t capacity; /* number of slots, power of two multiple of HT_INT_GROUP, at least two groups */
+	unsigned shift; /* 64 - log2(capacity / HT_INT_GROUP) */
+} LinearIntTable;
+
+/* bit i set when group[i] == key */
+static unsigned ht_int_group_match(uint64_t *group, uint64_t key) {
+#if defined(__AVX2__)
+	__m256i g = _mm256_loadu_si256((__m256i *)group);
+	return (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(g, _mm256_set1_epi64x((long long)key))));
+#elif defined(HT_SSE2)
+	/* no 64 bit compare before sse4.1: both 32 bit halves have to match */
+	__m128i k = _mm_set1_epi64x((long long)key);
+	__m128i lo = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)group), k);
+	__m128i hi = _mm_cmpeq_epi32(_mm_loadu_si128((__m128i *)(group + 2)), k);
+	lo = _mm_and_si128(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 3, 0, 1)));
+	hi = _mm_and_si128(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 3, 0, 1)));
+	return (unsigned)(_mm_movemask_pd(_mm_castsi128_pd(lo)) | _mm_movemask_pd(_mm_castsi128_pd(hi)) << 2);
+#else
+	unsigned mask = 0;
+	for (int i = 0; i < HT_INT_GROUP; ++i) {
+		mask |= (unsigned)(group[i] == key) << i;
+	}
+	return mask;
+#endif
+}
+
+/* first slot of the home group */
+static size_t ht_int_home(LinearIntTable *ht, uint64_t key) {
+	return (size_t)((key * HT_INT_MUL) >> ht->shift) * HT_INT_GROUP;
+}
+
+static void ht_int_alloc_slots(LinearIntTable *ht, size_t capacity) {
+	unsigned shift = 64;
+	size_t groups;
+
+	assert(capacity >= 2 * HT_INT_GROUP && is_power_of_two(capacity));
+	for (groups = capacity / HT_INT_GROUP; groups > 1; groups /= 2) {
+		shift -= 1;
+	}
+
+	ht->keys = malloc(capacity * sizeof(uint64_t));
+	assert("OOM" && ht->keys);
+	memset(ht->keys, 0xff, capacity * sizeof(uint64_t));
+
+	ht->values = malloc(ht->value_size * capacity);
+	assert("OOM" && ht->values);
+
+	ht->capacity = capacity;
+	ht->shift = shift;
+	ht->size = ht->has_empty_key;
+}
+
+static size_t ht_int_capacity_for(size_t count) {
+	size_t capacity = 2 * HT_INT_GROUP;
+	while (HT_INT_MAX_LOAD(capacity) < count) {
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+LinearIntTable ht_int_create(size_t value_size, size_t max_size_estimate) {
+	LinearIntTable ht;
+
+	assert(value_size);
+	memset(&ht, 0, sizeof(ht));
+	ht.value_size = value_size;
+	ht.empty_key_value = malloc(value_size);
+	assert("OOM" && ht.empty_key_value);
+	ht_int_alloc_slots(&ht, ht_int_capacity_for(max_size_estimate));
+
+	return ht;
+}
+
+void ht_int_destroy(LinearIntTable *ht) {
+	assert(ht && ht->capacity && ht->keys && ht->values);
+	free(ht->keys);
+	free(ht->values);
+	free(ht->empty_key_value);
+	memset(ht, 0, sizeof(*ht));
+}
+
+void *ht_int_nth_value(LinearIntTable *ht, size_t n) {
+	return (char *)ht->values + n * ht->value_size;
+}
+
+size_t ht_int_bytes(LinearIntTable *ht) {
+	return ht->capacity * (sizeof(uint64_t) + ht->value_size) + ht->value_size;
+}
+
+/* returns the slot holding key, or ht->capacity when it is missing */
+static size_t ht_int_find(LinearIntTable *ht, uint64_t key) {
+	size_t base = ht_int_home(ht, key);
+	ht_mask match;
+
+	for (;;) {
+		match = ht_int_group_match(ht->keys + base, key);
+		if (match) {
+			return base + ht_mask_next(&match);
+		}
+		if (ht_int_group_match(ht->keys + base, HT_INT_EMPTY_KEY)) {
+			return ht->capacity;
+		}
+		base = (base + HT_INT_GROUP) & (ht->capacity - 1);
+	}
+}
+
+static size_t ht_int_find_empty(LinearIntTable *ht, uint64_t key) {
+	size_t base = ht_int_home(ht, key);
+	ht_mask match;
+
+	for (;;) {
+		match = ht_int_group_match(ht->keys + base, HT_INT_EMPTY_KEY);
+		if (match) {
+			return base + ht_mask_next(&match);
+		}
+		base = (base + HT_INT_GROUP) & (ht->capacity - 1);
+	}
+}
+
+static void ht_int_rehash(LinearIntTable *ht, size_t new_capacity) {
+	LinearIntTable old = *ht;
+	size_t i, slot;
+
+	ht_int_alloc_slots(ht, new_capacity);
+
+	for (i = 0; i < old.capacity; ++i) {
+		if (old.keys[i] == HT_INT_EMPTY_KEY) continue;
+		slot = ht_int_find_empty(ht, old.keys[i]);
+		ht->keys[slot] = old.keys[i];
+		memcpy(ht_int_nth_value(ht, slot), ht_int_nth_value(&old, i), ht->value_size);
+		ht->size += 1;
+	}
+
+	free(old.keys);
+	free(old.values);
+}
+
+void ht_int_set(LinearIntTable *ht, uint64_t key, void *value) {
+	size_t slot;
+
+	if (key == HT_INT_EMPTY_KEY) {
+		ht->size += !ht->has_empty_key;
+		ht->has_empty_key = 1;
+		memcpy(ht->empty_key_value, value, ht->value_size);
+		return;
+	}
+
+	slot = ht_int_find(ht, key);
+	if (slot != ht->capacity) {
+		memcpy(ht_int_nth_value(ht, slot), value, ht->value_size);
+		return;
+	}
+
+	if (ht->size + 1 > HT_INT_MAX_LOAD(ht->capacity)) {
+		ht_int_rehash(ht, ht->capacity * 2);
+	}
+
+	slot = ht_int_find_empty(ht, key);
+	ht->keys[slot] = key;
+	memcpy(ht_int_nth_value(ht, slot), value, ht->value_size);
+	ht->size += 1;
+}
+
+int ht_int_remove(LinearIntTable *ht, uint64_t key) {
+	size_t mask = ht->capacity - 1;
+	size_t hole, next, home;
+
+	if (key == HT_INT_EMPTY_KEY) {
+		if (!ht->has_empty_key) {
+			return 0;
+		}
+		ht->has_empty_key = 0;
+		ht->size -= 1;
+		return 1;
+	}
+
+	hole = ht_int_find(ht, key);
+	if (hole == ht->capacity) {
+		return 0;
+	}
+
+	/* a later key moves into the hole when the hole sits between its home and its slot */
+	for (next = (hole + 1) & mask; ht->keys[next] != HT_INT_EMPTY_KEY; next = (next + 1) & mask) {
+		home = ht_int_home(ht, ht->keys[next]);
+		if (((next - home) & mask) >= ((next - hole) & mask)) {
+			ht->keys[hole] = ht->keys[next];
+			memcpy(ht_int_nth_value(ht, hole), ht_int_nth_value(ht, next), ht->value_size);
+			hole = next;
+		}
+	}
+	ht->keys[hole] = HT_INT_EMPTY_KEY;
+	ht->size -= 1;
+
+	return 1;
+}
+
+/* points into the table, valid until the next set or remove */
+void *ht_int_get(LinearIntTable *ht, uint64_t key) {
+	size_t slot;
+
+	if (key == HT_INT_EMPTY_KEY) {
+		return ht->has_empty_key ? ht->empty_key_value : NULL;
+	}
+
+	slot = ht_int_find(ht, key);
+	if (slot == ht->capacity) {
+		return NULL;
+	}
+
+	return ht_int_nth_value(ht, slot);
+}
+
+#endif /* HT_LINEAR_H */
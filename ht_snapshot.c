@@ -0,0 +1,161 @@
+#include "ht_snapshot.h"
+
+/*
+	builds a table, saves it, maps it back and checks every key against the
+	snapshot, then saves over it while it is still mapped and checks that a
+	damaged bucket directory is refused. prints how long the rebuild takes
+	next to the load.
+	usage: ht_snapshot [path]
+*/
+
+#define BUFFER_SIZE (128 * 1024 * 1024)
+static char buffer[BUFFER_SIZE];
+
+#define KEY_COUNT 1000000
+#define INITIAL_BUCKET_COUNT 1024
+#define MAX_KEY_LENGTH 32
+#define BUCKET_MAX_CAPACITY 48
+#define BUCKET_INITIAL_CAPACITY 4
+
+/* every third key is long enough to be stored out of line */
+static String8
+key_for(size_t i, char *key_buffer, size_t key_buffer_size)
+{
+	String8 key;
+
+	key.ptr = key_buffer;
+	key.len = snprintf(key_buffer, key_buffer_size, i % 3 ? "p%zu" : "snapshot_key_%zu", i);
+
+	return key;
+}
+
+/* points the first non-empty bucket of the snapshot at path past the end of the file */
+static int
+corrupt_directory(const char *path)
+{
+	HashTable_Snapshot_Header header;
+	HashTable_Snapshot_Bucket entry;
+	FILE *file = fopen(path, "r+b");
+	int ok = 0;
+
+	if (file == NULL)
+	{
+		return 0;
+	}
+	if (fread(&header, sizeof(header), 1, file) == 1)
+	{
+		while (fread(&entry, sizeof(entry), 1, file) == 1)
+		{
+			if (entry.size)
+			{
+				entry.offset = header.file_size;
+				ok = fseek(file, -(long)sizeof(entry), SEEK_CUR) == 0 &&
+					fwrite(&entry, sizeof(entry), 1, file) == 1;
+				break;
+			}
+		}
+	}
+	if (fclose(file) != 0)
+	{
+		ok = 0;
+	}
+
+	return ok;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = argc > 1 ? argv[1] : "ht_snapshot.bin";
+	HashTable hash_table;
+	HashTable_Snapshot snapshot;
+	uint64_t value, start, build_ns, save_ns, load_ns, get_ns;
+	char key_buffer[MAX_KEY_LENGTH + 1];
+	size_t i;
+	int ok;
+
+	start = time_now_ns();
+	hash_table = HashTable_Create(INITIAL_BUCKET_COUNT,
+					Wy_Hash,
+					MAX_KEY_LENGTH,
+					sizeof(uint64_t),
+					buffer, BUFFER_SIZE,
+					BUCKET_MAX_CAPACITY,
+					BUCKET_INITIAL_CAPACITY);
+	for (i = 0; i < KEY_COUNT; ++i)
+	{
+		value = i * 7;
+		ok = HashTable_SetS(&hash_table, key_for(i, key_buffer, sizeof(key_buffer)), &value);
+		assert(ok);
+	}
+	/* removes leave dead key bytes behind, the snapshot only keeps live ones */
+	for (i = 0; i < KEY_COUNT; i += 10)
+	{
+		ok = HashTable_RemoveS(&hash_table, key_for(i, key_buffer, sizeof(key_buffer)));
+		assert(ok);
+	}
+	build_ns = time_now_ns() - start;
+
+	start = time_now_ns();
+	if (!HashTable_Snapshot_Save(&hash_table, path))
+	{
+		fprintf(stderr, "could not write %s\n", path);
+		return 1;
+	}
+	save_ns = time_now_ns() - start;
+
+	start = time_now_ns();
+	if (!HashTable_Snapshot_Load(&snapshot, path, Wy_Hash, 0))
+	{
+		fprintf(stderr, "could not load %s\n", path);
+		return 1;
+	}
+	load_ns = time_now_ns() - start;
+	assert(snapshot.size == hash_table.size);
+
+	start = time_now_ns();
+	for (i = 0; i < KEY_COUNT; ++i)
+	{
+		value = 0;
+		ok = HashTable_Snapshot_GetS(&snapshot, key_for(i, key_buffer, sizeof(key_buffer)), &value);
+		assert(ok == (i % 10 != 0));
+		assert(!ok || value == i * 7);
+	}
+	assert(!HashTable_Snapshot_Get(&snapshot, "missing", NULL));
+	get_ns = time_now_ns() - start;
+
+	/* the new file is renamed over the old one, the mapping keeps the old contents */
+	value = 1;
+	ok = HashTable_Set(&hash_table, "saved_later", &value);
+	assert(ok);
+	ok = HashTable_Snapshot_Save(&hash_table, path);
+	assert(ok);
+	assert(!HashTable_Snapshot_Get(&snapshot, "saved_later", NULL));
+	ok = HashTable_Snapshot_Get(&snapshot, "p1", &value);
+	assert(ok && value == 7);
+	HashTable_Snapshot_Unload(&snapshot);
+
+	ok = HashTable_Snapshot_Load(&snapshot, path, Wy_Hash, 1);
+	assert(ok);
+	HashTable_Snapshot_Unload(&snapshot);
+
+	/* a different hash function would look in the wrong buckets */
+	ok = HashTable_Snapshot_Load(&snapshot, path, FNV1a_Hash, 0);
+	assert(!ok);
+
+	/* a bucket pointing past the end of the file is caught without the checksum */
+	ok = corrupt_directory(path);
+	assert(ok);
+	ok = HashTable_Snapshot_Load(&snapshot, path, Wy_Hash, 0);
+	assert(!ok);
+	ok = HashTable_Snapshot_Save(&hash_table, path);
+	assert(ok);
+
+	printf("entries %zu\n", hash_table.size);
+	printf("build %.2f ms\n", (double)build_ns / 1e6);
+	printf("save  %.2f ms\n", (double)save_ns / 1e6);
+	printf("load  %.2f ms\n", (double)load_ns / 1e6);
+	printf("gets  %.2f ns/op\n", (double)get_ns / KEY_COUNT);
+
+	return 0;
+}
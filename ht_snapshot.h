@@ -0,0 +1,500 @@
+#ifndef HT_SNAPSHOT_H
+#define HT_SNAPSHOT_H
+
+#include "ht_bucket.h"
+
+/*
+	read-only on-disk image of a HashTable that is served straight from a
+	file mapping. the layout mirrors the live buckets but every pointer is
+	a byte offset from the start of the file:
+
+	[header][bucket directory][bucket block][bucket block]...
+
+	the directory holds one {offset, size} per bucket, a bucket block is
+	[tags][HashTable_Key keys][values][out of line key bytes] laid out like
+	the live entries block, with out of line keys holding a 64 bit file offset
+	where the live table keeps a pointer.
+
+	lookups pick the bucket with hash % bucket_count like the table did, so
+	the loader has to use the same hash function, and for the seeded hashes
+	the same hash_seed. the header keeps the hash of a fixed probe key to
+	catch a mismatch at load time.
+*/
+
+#define HASHTABLE_SNAPSHOT_MAGIC "VCHTSNAP"
+#define HASHTABLE_SNAPSHOT_VERSION 1
+#define HASHTABLE_SNAPSHOT_BYTE_ORDER 0x01020304u
+#define HASHTABLE_SNAPSHOT_PROBE "vclib hashtable snapshot probe"
+#define HASHTABLE_SNAPSHOT_ALIGN 16
+
+/* the body checksum chains hash_wy over blocks of this many bytes */
+#define HASHTABLE_SNAPSHOT_BLOCK 4096
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t checksum; /* body blocks, then the header with this field zeroed */
+	uint64_t file_size;
+	uint64_t value_size;
+	uint64_t max_key_length;
+	uint64_t size;
+	uint64_t bucket_count;
+	uint64_t directory_offset;
+	uint64_t probe_hash;
+} HashTable_Snapshot_Header;
+
+typedef struct {
+	uint64_t offset;
+	uint64_t size;
+} HashTable_Snapshot_Bucket;
+
+typedef struct {
+	String8 mapping;
+	HashTable_Snapshot_Header *header;
+	HashTable_Snapshot_Bucket *buckets;
+	size_t bucket_count;
+	size_t value_size;
+	size_t max_key_length;
+	size_t size;
+	HashFn hash_fn;
+} HashTable_Snapshot;
+
+typedef struct {
+	FILE *file;
+	char block[HASHTABLE_SNAPSHOT_BLOCK];
+	size_t used;
+	uint64_t offset;
+	uint64_t checksum;
+	int ok;
+} HashTable_Snapshot_Writer;
+
+static uint64_t
+HashTable_Snapshot_Checksum(char *body, size_t body_size, HashTable_Snapshot_Header header)
+{
+	uint64_t checksum = 0;
+	size_t offset, n;
+
+	for (offset = 0; offset < body_size; offset += n)
+	{
+		n = body_size - offset < HASHTABLE_SNAPSHOT_BLOCK ? body_size - offset : HASHTABLE_SNAPSHOT_BLOCK;
+		checksum = hash_wy(body + offset, n, checksum);
+	}
+
+	header.checksum = 0;
+	return hash_wy(&header, sizeof(header), checksum);
+}
+
+static void
+HashTable_Snapshot_Flush(HashTable_Snapshot_Writer *writer)
+{
+	if (writer->used == 0)
+	{
+		return;
+	}
+
+	writer->checksum = hash_wy(writer->block, writer->used, writer->checksum);
+	if (fwrite(writer->block, 1, writer->used, writer->file) != writer->used)
+	{
+		writer->ok = 0;
+	}
+	writer->used = 0;
+}
+
+/* data NULL writes zero bytes */
+static void
+HashTable_Snapshot_Write(HashTable_Snapshot_Writer *writer, const void *data, size_t size)
+{
+	size_t n;
+
+	writer->offset += size;
+	while (size)
+	{
+		n = HASHTABLE_SNAPSHOT_BLOCK - writer->used;
+		if (n > size)
+		{
+			n = size;
+		}
+
+		if (data)
+		{
+			memcpy(writer->block + writer->used, data, n);
+			data = (const char *)data + n;
+		}
+		else
+		{
+			memset(writer->block + writer->used, 0, n);
+		}
+
+		writer->used += n;
+		size -= n;
+		if (writer->used == HASHTABLE_SNAPSHOT_BLOCK)
+		{
+			HashTable_Snapshot_Flush(writer);
+		}
+	}
+}
+
+static void
+HashTable_Snapshot_Write_Align(HashTable_Snapshot_Writer *writer)
+{
+	HashTable_Snapshot_Write(writer, NULL, align(writer->offset, HASHTABLE_SNAPSHOT_ALIGN) - writer->offset);
+}
+
+static uint64_t
+HashTable_Snapshot_Bucket_Size(HashTable *hash_table, HashTable_Bucket *bucket)
+{
+	return HashTable_Bucket_Tags_Size(bucket->size) +
+		bucket->size * (sizeof(HashTable_Key) + hash_table->value_size) +
+		(bucket->key_bytes_used - bucket->dead_key_bytes);
+}
+
+static void
+HashTable_Snapshot_Write_Bucket(HashTable_Snapshot_Writer *writer, HashTable *hash_table, HashTable_Bucket *bucket)
+{
+	HashTable_Key slot;
+	String8 key;
+	uint64_t key_offset;
+	uint32_t len;
+	size_t i;
+
+	key_offset = writer->offset + HashTable_Bucket_Tags_Size(bucket->size) +
+		bucket->size * (sizeof(HashTable_Key) + hash_table->value_size);
+
+	HashTable_Snapshot_Write(writer, bucket->tags, bucket->size);
+	HashTable_Snapshot_Write(writer, NULL, HashTable_Bucket_Tags_Size(bucket->size) - bucket->size);
+
+	for (i = 0; i < bucket->size; ++i)
+	{
+		slot = bucket->keys[i];
+		if (slot.len == HASHTABLE_KEY_OUT_OF_LINE)
+		{
+			len = (uint32_t)HashTable_Key_View(&slot).len;
+			memset(slot.bytes, 0, sizeof(slot.bytes));
+			memcpy(slot.bytes, &key_offset, sizeof(key_offset));
+			memcpy(slot.bytes + sizeof(key_offset), &len, sizeof(len));
+			key_offset += len;
+		}
+		HashTable_Snapshot_Write(writer, &slot, sizeof(slot));
+	}
+
+	HashTable_Snapshot_Write(writer, bucket->values, bucket->size * hash_table->value_size);
+
+	for (i = 0; i < bucket->size; ++i)
+	{
+		if (bucket->keys[i].len == HASHTABLE_KEY_OUT_OF_LINE)
+		{
+			key = HashTable_Key_View(&bucket->keys[i]);
+			HashTable_Snapshot_Write(writer, key.ptr, key.len);
+		}
+	}
+
+	HashTable_Snapshot_Write_Align(writer);
+}
+
+/* replaces path with temp_path, the old file stays whole for whoever still maps it */
+static int
+HashTable_Snapshot_Replace(const char *temp_path, const char *path)
+{
+#ifdef _WIN32
+	return MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(temp_path, path) == 0;
+#endif
+}
+
+/*
+	writes hash_table to path, finishing any rehash in progress first. the
+	snapshot goes to path.tmp and is renamed over path once complete, so
+	path holds either the old snapshot or the new one, never a torn file.
+	returns 0 when the file could not be written or the table arena has no
+	room to finish the rehash.
+*/
+int
+HashTable_Snapshot_Save(HashTable *hash_table, const char *path)
+{
+	HashTable_Snapshot_Writer writer;
+	HashTable_Snapshot_Header header;
+	HashTable_Snapshot_Bucket entry;
+	HashTable_Bucket *bucket;
+	uint64_t offset;
+	size_t i, temp_path_size;
+	char *temp_path;
+
+	assert(sizeof(header) % HASHTABLE_SNAPSHOT_ALIGN == 0);
+
+	if (!HashTable_Rehash_Step(hash_table, SIZE_MAX))
+	{
+		return 0;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, HASHTABLE_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = HASHTABLE_SNAPSHOT_VERSION;
+	header.byte_order = HASHTABLE_SNAPSHOT_BYTE_ORDER;
+	header.value_size = hash_table->value_size;
+	header.max_key_length = hash_table->max_key_length;
+	header.size = hash_table->size;
+	header.bucket_count = hash_table->buckets.size;
+	header.directory_offset = sizeof(header);
+	header.probe_hash = hash_table->hash_fn(string8_borrow(HASHTABLE_SNAPSHOT_PROBE));
+
+	temp_path_size = strlen(path) + sizeof(".tmp");
+	temp_path = malloc(temp_path_size);
+	assert("OOM" && temp_path);
+	snprintf(temp_path, temp_path_size, "%s.tmp", path);
+
+	memset(&writer, 0, sizeof(writer));
+	writer.ok = 1;
+	writer.file = fopen(temp_path, "wb");
+	if (writer.file == NULL)
+	{
+		free(temp_path);
+		return 0;
+	}
+
+	/* the header goes in last, once the checksum is known */
+	if (fwrite(&header, 1, sizeof(header), writer.file) != sizeof(header))
+	{
+		writer.ok = 0;
+	}
+	writer.offset = header.directory_offset;
+
+	offset = align(header.directory_offset + header.bucket_count * sizeof(HashTable_Snapshot_Bucket), HASHTABLE_SNAPSHOT_ALIGN);
+	for (i = 0; i < hash_table->buckets.size; ++i)
+	{
+		bucket = &hash_table->buckets.ptr[i];
+		entry.offset = bucket->size ? offset : 0;
+		entry.size = bucket->size;
+		HashTable_Snapshot_Write(&writer, &entry, sizeof(entry));
+		if (bucket->size)
+		{
+			offset = align(offset + HashTable_Snapshot_Bucket_Size(hash_table, bucket), HASHTABLE_SNAPSHOT_ALIGN);
+		}
+	}
+	HashTable_Snapshot_Write_Align(&writer);
+
+	for (i = 0; i < hash_table->buckets.size; ++i)
+	{
+		bucket = &hash_table->buckets.ptr[i];
+		if (bucket->size)
+		{
+			HashTable_Snapshot_Write_Bucket(&writer, hash_table, bucket);
+		}
+	}
+	HashTable_Snapshot_Flush(&writer);
+	assert(writer.offset == offset);
+
+	header.file_size = writer.offset;
+	header.checksum = hash_wy(&header, sizeof(header), writer.checksum);
+
+	if (fseek(writer.file, 0, SEEK_SET) != 0 ||
+		fwrite(&header, 1, sizeof(header), writer.file) != sizeof(header))
+	{
+		writer.ok = 0;
+	}
+	if (fclose(writer.file) != 0)
+	{
+		writer.ok = 0;
+	}
+
+	if (writer.ok && !HashTable_Snapshot_Replace(temp_path, path))
+	{
+		writer.ok = 0;
+	}
+	if (!writer.ok)
+	{
+		remove(temp_path);
+	}
+	free(temp_path);
+
+	return writer.ok;
+}
+
+/*
+	every bucket block the directory points at lies past the directory and
+	inside the file, and the bucket sizes add up to the entry count. the out
+	of line key offsets inside the blocks are only covered by the checksum.
+*/
+static int
+HashTable_Snapshot_Directory_Valid(HashTable_Snapshot_Header *header, String8 mapping)
+{
+	HashTable_Snapshot_Bucket *entry;
+	uint64_t blocks_start, room, slot_size, size = 0;
+	size_t i;
+
+	blocks_start = align(header->directory_offset + header->bucket_count * sizeof(HashTable_Snapshot_Bucket), HASHTABLE_SNAPSHOT_ALIGN);
+	slot_size = sizeof(HashTable_Key) + header->value_size;
+
+	for (i = 0; i < header->bucket_count; ++i)
+	{
+		entry = (HashTable_Snapshot_Bucket *)(mapping.ptr + header->directory_offset) + i;
+		if (entry->size == 0)
+		{
+			continue;
+		}
+		if (entry->offset < blocks_start ||
+			entry->offset % HASHTABLE_SNAPSHOT_ALIGN != 0 ||
+			entry->offset > mapping.len)
+		{
+			return 0;
+		}
+
+		/* tags take a byte per entry, rounded up to a group, so the first test keeps the second from overflowing */
+		room = mapping.len - entry->offset;
+		if (entry->size > room / (slot_size + 1) ||
+			HashTable_Bucket_Tags_Size(entry->size) + entry->size * slot_size > room)
+		{
+			return 0;
+		}
+		size += entry->size;
+	}
+
+	return size == header->size;
+}
+
+/*
+	maps a snapshot written by HashTable_Snapshot_Save. only the header and
+	the bucket directory are validated unless verify_checksum is set, which
+	reads the whole file.
+	returns 0 for a missing, corrupt or incompatible file, or when hash_fn
+	does not hash like the one the snapshot was saved with.
+*/
+int
+HashTable_Snapshot_Load(HashTable_Snapshot *snapshot, const char *path, HashFn hash_fn, int verify_checksum)
+{
+	HashTable_Snapshot_Header *header;
+	String8 mapping;
+	uint64_t directory_end;
+
+	memset(snapshot, 0, sizeof(*snapshot));
+
+	mapping = file_map_readonly(path);
+	if (mapping.ptr == NULL)
+	{
+		return 0;
+	}
+	header = (HashTable_Snapshot_Header *)mapping.ptr;
+
+	if (mapping.len < sizeof(*header))
+	{
+		file_unmap(mapping);
+		return 0;
+	}
+
+	directory_end = header->directory_offset + header->bucket_count * sizeof(HashTable_Snapshot_Bucket);
+	if (memcmp(header->magic, HASHTABLE_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+		header->version != HASHTABLE_SNAPSHOT_VERSION ||
+		header->byte_order != HASHTABLE_SNAPSHOT_BYTE_ORDER ||
+		header->file_size != mapping.len ||
+		header->value_size == 0 ||
+		header->value_size > mapping.len ||
+		header->bucket_count == 0 ||
+		header->bucket_count > mapping.len / sizeof(HashTable_Snapshot_Bucket) ||
+		header->directory_offset != sizeof(*header) ||
+		directory_end > mapping.len ||
+		!HashTable_Snapshot_Directory_Valid(header, mapping) ||
+		header->probe_hash != hash_fn(string8_borrow(HASHTABLE_SNAPSHOT_PROBE)) ||
+		(verify_checksum &&
+		 header->checksum != HashTable_Snapshot_Checksum(mapping.ptr + header->directory_offset,
+						mapping.len - header->directory_offset,
+						*header)))
+	{
+		file_unmap(mapping);
+		return 0;
+	}
+
+	snapshot->mapping = mapping;
+	snapshot->header = header;
+	snapshot->buckets = (HashTable_Snapshot_Bucket *)(mapping.ptr + header->directory_offset);
+	snapshot->bucket_count = header->bucket_count;
+	snapshot->value_size = header->value_size;
+	snapshot->max_key_length = header->max_key_length;
+	snapshot->size = header->size;
+	snapshot->hash_fn = hash_fn;
+
+	return 1;
+}
+
+void
+HashTable_Snapshot_Unload(HashTable_Snapshot *snapshot)
+{
+	file_unmap(snapshot->mapping);
+	memset(snapshot, 0, sizeof(*snapshot));
+}
+
+static int
+HashTable_Snapshot_Key_Eq(HashTable_Snapshot *snapshot, HashTable_Key *slot, String8 key)
+{
+	uint64_t offset;
+	uint32_t len;
+
+	if (slot->len != HASHTABLE_KEY_OUT_OF_LINE)
+	{
+		return slot->len == key.len && memcmp(slot->bytes, key.ptr, key.len) == 0;
+	}
+
+	memcpy(&offset, slot->bytes, sizeof(offset));
+	memcpy(&len, slot->bytes + sizeof(offset), sizeof(len));
+
+	return len == key.len && memcmp(snapshot->mapping.ptr + offset, key.ptr, key.len) == 0;
+}
+
+int
+HashTable_Snapshot_GetSH(HashTable_Snapshot *snapshot, String8 key, size_t hash, void *out_value)
+{
+	HashTable_Snapshot_Bucket *bucket;
+	unsigned char *tags;
+	HashTable_Key *keys;
+	size_t base, i;
+	unsigned int match;
+
+	if (key.len > snapshot->max_key_length)
+	{
+		return 0;
+	}
+
+	bucket = &snapshot->buckets[hash % snapshot->bucket_count];
+	tags = (unsigned char *)snapshot->mapping.ptr + bucket->offset;
+	keys = (HashTable_Key *)(tags + HashTable_Bucket_Tags_Size(bucket->size));
+
+	for (base = 0; base < bucket->size; base += HASHTABLE_TAG_GROUP)
+	{
+		match = HashTable_Tags_Match(&tags[base], HashTable_Tag(hash));
+		if (bucket->size - base < HASHTABLE_TAG_GROUP)
+		{
+			match &= (1u << (bucket->size - base)) - 1;
+		}
+
+		while (match)
+		{
+			i = base + HashTable_Mask_Next(&match);
+			if (HashTable_Snapshot_Key_Eq(snapshot, &keys[i], key))
+			{
+				if (out_value)
+				{
+					memcpy(out_value,
+						nth_no_bounds_checking(keys + bucket->size, i, snapshot->value_size),
+						snapshot->value_size);
+				}
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int
+HashTable_Snapshot_GetS(HashTable_Snapshot *snapshot, String8 key, void *out_value)
+{
+	return HashTable_Snapshot_GetSH(snapshot, key, snapshot->hash_fn(key), out_value);
+}
+
+int
+HashTable_Snapshot_Get(HashTable_Snapshot *snapshot, char *key, void *out_value)
+{
+	return HashTable_Snapshot_GetS(snapshot, string8_borrow(key), out_value);
+}
+
+#endif /* HT_SNAPSHOT_H */
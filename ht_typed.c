@@ -0,0 +1,176 @@
+#include "ht_typed.h"
+
+/*
+	integer keys and small struct values through DEFINE_HASHTABLE and
+	LinearIntTable against the same workload on LinearHashTable with runtime
+	key / value sizes.
+	usage: ht_typed [count]
+*/
+
+typedef struct {
+	float x;
+	float y;
+} Point;
+
+DEFINE_HASHTABLE(PointMap, uint64_t, Point, ht_hash_u64, ht_eq_scalar)
+
+#define DEFAULT_COUNT 1000000
+
+static size_t
+linear_hash_u64(char *key, size_t key_size)
+{
+	uint64_t k;
+
+	assert(key_size == sizeof(k));
+	memcpy(&k, key, sizeof(k));
+
+	return ht_hash_u64(k);
+}
+
+static uint64_t
+key_at(size_t i)
+{
+	/* spread out so neighbouring keys do not share low bits */
+	return (uint64_t)i * 0x9e3779b97f4a7c15ULL;
+}
+
+static void
+report(const char *table, const char *op, uint64_t elapsed, size_t count)
+{
+	printf("%-8s %-8s %10.2f\n", table, op, (double)elapsed / (double)count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t count = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : DEFAULT_COUNT;
+	LinearHashTable linear;
+	LinearIntTable integer;
+	PointMap typed;
+	Point p, *q;
+	uint64_t key, start;
+	size_t i;
+	float sum = 0;
+
+	printf("%-8s %-8s %10s\n", "table", "op", "ns/op");
+
+	linear = ht_create(sizeof(uint64_t), sizeof(Point), 16, linear_hash_u64);
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		key = key_at(i);
+		p.x = p.y = (float)i;
+		ht_set(&linear, &key, &p);
+	}
+	report("linear", "set", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		key = key_at(i);
+		q = ht_get(&linear, &key);
+		sum += q->x;
+	}
+	report("linear", "get_hit", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = count; i < 2 * count; ++i)
+	{
+		key = key_at(i);
+		sum += ht_get(&linear, &key) != NULL;
+	}
+	report("linear", "get_miss", time_now_ns() - start, count);
+
+	typed = PointMap_create(16);
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		p.x = p.y = (float)i;
+		PointMap_set(&typed, key_at(i), p);
+	}
+	report("typed", "set", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		q = PointMap_get(&typed, key_at(i));
+		sum += q->x;
+	}
+	report("typed", "get_hit", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = count; i < 2 * count; ++i)
+	{
+		sum += PointMap_get(&typed, key_at(i)) != NULL;
+	}
+	report("typed", "get_miss", time_now_ns() - start, count);
+
+	integer = ht_int_create(sizeof(Point), 16);
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		p.x = p.y = (float)i;
+		ht_int_set(&integer, key_at(i), &p);
+	}
+	report("int", "set", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		q = ht_int_get(&integer, key_at(i));
+		sum += q->x;
+	}
+	report("int", "get_hit", time_now_ns() - start, count);
+
+	start = time_now_ns();
+	for (i = count; i < 2 * count; ++i)
+	{
+		sum += ht_int_get(&integer, key_at(i)) != NULL;
+	}
+	report("int", "get_miss", time_now_ns() - start, count);
+
+	assert(typed.size == linear.size && integer.size == linear.size);
+	for (i = 0; i < count; i += 2)
+	{
+		assert(PointMap_remove(&typed, key_at(i)));
+	}
+	for (i = 0; i < count; ++i)
+	{
+		q = PointMap_get(&typed, key_at(i));
+		assert((i % 2 == 0) == (q == NULL));
+		assert(!q || q->x == (float)i);
+	}
+
+	/* removes shift keys back, everything else has to stay reachable */
+	for (i = 0; i < count; i += 2)
+	{
+		assert(ht_int_remove(&integer, key_at(i)));
+	}
+	assert(!ht_int_remove(&integer, key_at(0)));
+	for (i = 0; i < count; ++i)
+	{
+		q = ht_int_get(&integer, key_at(i));
+		assert((i % 2 == 0) == (q == NULL));
+		assert(!q || q->x == (float)i);
+	}
+
+	/* the empty key sentinel goes to the side slot */
+	p.x = p.y = -1;
+	ht_int_set(&integer, HT_INT_EMPTY_KEY, &p);
+	q = ht_int_get(&integer, HT_INT_EMPTY_KEY);
+	assert(q && q->x == -1);
+	assert(ht_int_remove(&integer, HT_INT_EMPTY_KEY) && !ht_int_get(&integer, HT_INT_EMPTY_KEY));
+	assert(integer.size == count / 2);
+
+	ht_destroy(&linear);
+	PointMap_destroy(&typed);
+	ht_int_destroy(&integer);
+
+	/* keeps the lookups alive */
+	fprintf(stderr, "sink %f\n", sum);
+
+	return 0;
+}
@@ -0,0 +1,206 @@
+#ifndef HT_TYPED_H
+#define HT_TYPED_H
+
+#include "ht_linear.h"
+
+/*
+	DEFINE_HASHTABLE(Name, KeyType, ValueType, hash, eq) generates a
+	LinearHashTable specialized for one key and value type:
+
+		DEFINE_HASHTABLE(PointMap, uint64_t, Point, ht_hash_u64, ht_eq_scalar)
+
+		PointMap map = PointMap_create(1024);
+		PointMap_set(&map, 42, p);
+		Point *q = PointMap_get(&map, 42);
+
+	hash is called as hash(key) and must return a size_t with well mixed high
+	and low bits, eq as eq(a, b). both may be macros. keys and values are
+	copied by assignment and sit next to each other in one slot array, so the
+	compiler sees their sizes, inlines hash and eq, and a hit usually touches
+	one cache line for the control byte group and one for the slot.
+	probing, control bytes and growth are the same as in ht_linear.h.
+*/
+
+size_t ht_hash_u64(uint64_t key) {
+	return (size_t)hash_mix(key ^ hash_seed ^ HASH_P0, HASH_P1);
+}
+
+#define ht_eq_scalar(a, b) ((a) == (b))
+
+#define DEFINE_HASHTABLE(Name, KeyType, ValueType, hash, eq)													\
+typedef struct {																								\
+	KeyType key;																								\
+	ValueType value;																							\
+} Name##_Slot;																									\
+																												\
+typedef struct {																								\
+	signed char *ctrl;																							\
+	Name##_Slot *slots;																							\
+	size_t size; /* number of live entries */																	\
+	size_t deleted; /* number of tombstones */																	\
+	size_t capacity; /* number of slots, power of two multiple of HT_GROUP_WIDTH */								\
+} Name;																											\
+																												\
+static void Name##_alloc_slots(Name *ht, size_t capacity) {														\
+	ht->ctrl = malloc(capacity);																				\
+	assert("OOM" && ht->ctrl);																					\
+	memset(ht->ctrl, HT_CTRL_EMPTY, capacity);																	\
+																												\
+	ht->slots = malloc(capacity * sizeof(Name##_Slot));															\
+	assert("OOM" && ht->slots);																					\
+																												\
+	ht->capacity = capacity;																					\
+	ht->size = 0;																								\
+	ht->deleted = 0;																							\
+}																												\
+																												\
+Name Name##_create(size_t max_size_estimate) {																	\
+	Name ht;																									\
+																												\
+	memset(&ht, 0, sizeof(ht));																					\
+	Name##_alloc_slots(&ht, ht_capacity_for(max_size_estimate));												\
+																												\
+	return ht;																									\
+}																												\
+																												\
+void Name##_destroy(Name *ht) {																					\
+	assert(ht && ht->capacity && ht->ctrl && ht->slots);														\
+	free(ht->ctrl);																								\
+	free(ht->slots);																							\
+	memset(ht, 0, sizeof(*ht));																					\
+}																												\
+																												\
+/* see ht_find */																								\
+static size_t Name##_find(Name *ht, KeyType key, size_t h, size_t *out_empty) {									\
+	size_t group_mask = ht->capacity / HT_GROUP_WIDTH - 1;														\
+	size_t g = HT_H1(h) & group_mask;																			\
+	signed char h2 = HT_H2(h);																					\
+	size_t step, base, slot;																					\
+	signed char *group;																							\
+	ht_mask match;																								\
+	int free_found = 0;																							\
+																												\
+	for (step = 1; step <= group_mask + 1; ++step) {															\
+		base = g * HT_GROUP_WIDTH;																				\
+		group = ht->ctrl + base;																				\
+																												\
+		match = ht_group_match(group, h2);																		\
+		while (match) {																							\
+			slot = base + ht_mask_next(&match);																	\
+			if (eq(ht->slots[slot].key, key)) {																	\
+				return slot;																					\
+			}																									\
+		}																										\
+																												\
+		if (out_empty && !free_found) {																			\
+			match = ht_group_match_free(group);																	\
+			if (match) {																						\
+				*out_empty = base + ht_mask_next(&match);														\
+				free_found = 1;																					\
+			}																									\
+		}																										\
+																												\
+		if (ht_group_match(group, HT_CTRL_EMPTY)) {																\
+			return ht->capacity;																				\
+		}																										\
+																												\
+		g = (g + step) & group_mask;																			\
+	}																											\
+																												\
+	assert(0);																									\
+	return ht->capacity;																						\
+}																												\
+																												\
+static size_t Name##_find_empty(Name *ht, size_t h) {															\
+	size_t group_mask = ht->capacity / HT_GROUP_WIDTH - 1;														\
+	size_t g = HT_H1(h) & group_mask;																			\
+	size_t step;																								\
+	ht_mask match;																								\
+																												\
+	for (step = 1; step <= group_mask + 1; ++step) {															\
+		match = ht_group_match(ht->ctrl + g * HT_GROUP_WIDTH, HT_CTRL_EMPTY);									\
+		if (match) {																							\
+			return g * HT_GROUP_WIDTH + ht_mask_next(&match);													\
+		}																										\
+		g = (g + step) & group_mask;																			\
+	}																											\
+																												\
+	assert(0);																									\
+	return ht->capacity;																						\
+}																												\
+																												\
+static void Name##_put_slot(Name *ht, size_t slot, size_t h, KeyType key, ValueType value) {					\
+	ht->ctrl[slot] = HT_H2(h);																					\
+	ht->slots[slot].key = key;																					\
+	ht->slots[slot].value = value;																				\
+	ht->size += 1;																								\
+}																												\
+																												\
+static void Name##_rehash(Name *ht, size_t new_capacity) {														\
+	Name old = *ht;																								\
+	size_t i, h;																								\
+																												\
+	Name##_alloc_slots(ht, new_capacity);																		\
+																												\
+	for (i = 0; i < old.capacity; ++i) {																		\
+		if (old.ctrl[i] < 0) continue;																			\
+		h = hash(old.slots[i].key);																				\
+		Name##_put_slot(ht, Name##_find_empty(ht, h), h, old.slots[i].key, old.slots[i].value);					\
+	}																											\
+																												\
+	Name##_destroy(&old);																						\
+}																												\
+																												\
+void Name##_set(Name *ht, KeyType key, ValueType value) {														\
+	size_t h = hash(key);																						\
+	size_t slot, empty = 0;																						\
+																												\
+	slot = Name##_find(ht, key, h, &empty);																		\
+	if (slot != ht->capacity) {																					\
+		ht->slots[slot].value = value;																			\
+		return;																									\
+	}																											\
+																												\
+	if (ht->ctrl[empty] == HT_CTRL_DELETED) {																	\
+		ht->deleted -= 1;																						\
+	} else if (ht->size + ht->deleted + 1 > HT_MAX_LOAD(ht->capacity)) {										\
+		Name##_rehash(ht, ht->size + 1 > HT_MAX_LOAD(ht->capacity) / 2 ? ht->capacity * 2 : ht->capacity);		\
+		empty = Name##_find_empty(ht, h);																		\
+	}																											\
+																												\
+	Name##_put_slot(ht, empty, h, key, value);																	\
+}																												\
+																												\
+/* see ht_remove */																								\
+int Name##_remove(Name *ht, KeyType key) {																		\
+	size_t slot = Name##_find(ht, key, hash(key), NULL);														\
+	size_t base;																								\
+																												\
+	if (slot == ht->capacity) {																					\
+		return 0;																								\
+	}																											\
+																												\
+	base = slot / HT_GROUP_WIDTH * HT_GROUP_WIDTH;																\
+	if (ht_group_match(ht->ctrl + base, HT_CTRL_EMPTY)) {														\
+		ht->ctrl[slot] = HT_CTRL_EMPTY;																			\
+	} else {																									\
+		ht->ctrl[slot] = HT_CTRL_DELETED;																		\
+		ht->deleted += 1;																						\
+	}																											\
+	ht->size -= 1;																								\
+																												\
+	return 1;																									\
+}																												\
+																												\
+/* points into the table, valid until the next set */															\
+ValueType *Name##_get(Name *ht, KeyType key) {																	\
+	size_t slot = Name##_find(ht, key, hash(key), NULL);														\
+																												\
+	if (slot == ht->capacity) {																					\
+		return NULL;																							\
+	}																											\
+																												\
+	return &ht->slots[slot].value;																				\
+}																												\
+
+#endif /* HT_TYPED_H */
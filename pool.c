@@ -0,0 +1,268 @@
+#include "bench.h"
+
+/*
+	churns a working set of fixed size records whose lifetimes do not nest:
+	every op frees a random live record and allocates a new one. runs it on
+	malloc, on a Pool, and from several threads on malloc and on one shared
+	Pool through a PoolCache each, checking that no live record is ever
+	handed out twice. prints ns per op and the arena bytes the pool needed.
+	usage: pool [threads] [op_count] [live_count]
+*/
+
+#define DEFAULT_OP_COUNT 4000000
+#define DEFAULT_LIVE_COUNT 100000
+#define MAX_THREADS 64
+
+typedef struct {
+	uint64_t stamp;
+	char payload[40];
+} Record;
+
+typedef struct {
+	size_t index;
+	size_t count;
+	size_t live_count;
+	Record **live;
+	PoolCache cache;
+	int use_pool;
+} Worker;
+
+static void
+record_stamp(Record *record, uint64_t stamp)
+{
+	record->stamp = stamp;
+	memset(record->payload, (int)(stamp & 0xff), sizeof(record->payload));
+}
+
+static void
+record_check(Record *record, uint64_t stamp)
+{
+	assert(record->stamp == stamp);
+	assert(record->payload[sizeof(record->payload) - 1] == (char)(stamp & 0xff));
+}
+
+static uint64_t
+make_stamp(size_t index, size_t slot)
+{
+	return (uint64_t)index << 40 | slot;
+}
+
+static void
+churn_malloc(Record **live, size_t live_count, size_t count, size_t index)
+{
+	uint64_t rng = rng_seed(index);
+	size_t i, slot;
+
+	for (i = 0; i < count; ++i)
+	{
+		slot = xorshift64(&rng) % live_count;
+		record_check(live[slot], make_stamp(index, slot));
+		free(live[slot]);
+		live[slot] = malloc(sizeof(Record));
+		assert("OOM" && live[slot]);
+		record_stamp(live[slot], make_stamp(index, slot));
+	}
+}
+
+static void
+churn_pool(Pool *pool, Record **live, size_t live_count, size_t count, size_t index)
+{
+	uint64_t rng = rng_seed(index);
+	size_t i, slot;
+
+	for (i = 0; i < count; ++i)
+	{
+		slot = xorshift64(&rng) % live_count;
+		record_check(live[slot], make_stamp(index, slot));
+		pool_free(pool, live[slot]);
+		live[slot] = pool_alloc_nozero(pool);
+		assert("OOM" && live[slot]);
+		record_stamp(live[slot], make_stamp(index, slot));
+	}
+}
+
+static void *
+worker_run(void *arg)
+{
+	Worker *worker = arg;
+	uint64_t rng = rng_seed(worker->index);
+	size_t i, slot;
+
+	if (!worker->use_pool)
+	{
+		churn_malloc(worker->live, worker->live_count, worker->count, worker->index);
+		return NULL;
+	}
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		slot = xorshift64(&rng) % worker->live_count;
+		record_check(worker->live[slot], make_stamp(worker->index, slot));
+		pool_cache_free(&worker->cache, worker->live[slot]);
+		worker->live[slot] = pool_cache_alloc_nozero(&worker->cache);
+		assert("OOM" && worker->live[slot]);
+		record_stamp(worker->live[slot], make_stamp(worker->index, slot));
+	}
+	pool_cache_flush(&worker->cache);
+
+	return NULL;
+}
+
+/* pool is NULL for the malloc runs */
+static void
+report(const char *op, uint64_t elapsed, size_t count, Pool *pool)
+{
+	printf("%-14s %10.2f ", op, (double)elapsed / (double)count);
+	if (pool)
+	{
+		printf("%12zu\n", pool->carved * pool->slot_size);
+	}
+	else
+	{
+		printf("%12s\n", "-");
+	}
+}
+
+static void
+run_threads(const char *op, Worker *workers, size_t thread_count, Pool *pool)
+{
+	thread_t threads[MAX_THREADS];
+	uint64_t start = time_now_ns();
+	size_t t, ops = 0;
+
+	for (t = 0; t < thread_count; ++t)
+	{
+		if (!thread_create(&threads[t], worker_run, &workers[t]))
+		{
+			fprintf(stderr, "thread_create failed\n");
+			exit(1);
+		}
+	}
+	for (t = 0; t < thread_count; ++t)
+	{
+		thread_join(threads[t]);
+		ops += workers[t].count;
+	}
+
+	report(op, time_now_ns() - start, ops, pool);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t thread_count = argc > 1 ? (size_t)atoi(argv[1]) : thread_hw_count();
+	size_t count = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : DEFAULT_OP_COUNT;
+	size_t live_count = argc > 3 ? (size_t)strtoull(argv[3], NULL, 10) : DEFAULT_LIVE_COUNT;
+	Worker workers[MAX_THREADS];
+	Record **live;
+	Arena arena;
+	Pool pool;
+	PoolCache main_cache;
+	uint64_t start;
+	size_t t, i;
+
+	if (thread_count == 0 || thread_count > MAX_THREADS)
+	{
+		thread_count = MAX_THREADS;
+	}
+
+	arena = arena_reserve((size_t)1024 * 1024 * 1024, 0);
+	live = malloc(thread_count * live_count * sizeof(Record *));
+	assert("OOM" && arena.buffer && live);
+
+	printf("%-14s %10s %12s\n", "op", "ns/op", "arena bytes");
+
+	/* one thread */
+	for (i = 0; i < live_count; ++i)
+	{
+		live[i] = malloc(sizeof(Record));
+		assert("OOM" && live[i]);
+		record_stamp(live[i], make_stamp(0, i));
+	}
+	start = time_now_ns();
+	churn_malloc(live, live_count, count, 0);
+	report("malloc", time_now_ns() - start, count, NULL);
+	for (i = 0; i < live_count; ++i)
+	{
+		free(live[i]);
+	}
+
+	pool_init(&pool, &arena, sizeof(Record), 8);
+	for (i = 0; i < live_count; ++i)
+	{
+		live[i] = pool_alloc(&pool);
+		assert("OOM" && live[i]);
+		record_stamp(live[i], make_stamp(0, i));
+	}
+	start = time_now_ns();
+	churn_pool(&pool, live, live_count, count, 0);
+	report("pool", time_now_ns() - start, count, &pool);
+
+	/* churn only reuses freed slots, the arena never grows past the working set */
+	assert(pool.carved == live_count && pool.used == live_count);
+	for (i = 0; i < live_count; ++i)
+	{
+		pool_free(&pool, live[i]);
+	}
+	assert(pool.used == 0);
+	pool_destroy(&pool);
+	arena_reset(&arena);
+
+	/* several threads, one shared pool */
+	memset(workers, 0, sizeof(workers));
+	for (t = 0; t < thread_count; ++t)
+	{
+		workers[t].index = t;
+		workers[t].count = count / thread_count;
+		workers[t].live_count = live_count;
+		workers[t].live = &live[t * live_count];
+		for (i = 0; i < live_count; ++i)
+		{
+			workers[t].live[i] = malloc(sizeof(Record));
+			assert("OOM" && workers[t].live[i]);
+			record_stamp(workers[t].live[i], make_stamp(t, i));
+		}
+	}
+	run_threads("malloc_threads", workers, thread_count, NULL);
+	for (i = 0; i < thread_count * live_count; ++i)
+	{
+		free(live[i]);
+	}
+
+	pool_init(&pool, &arena, sizeof(Record), 8);
+	main_cache = pool_cache_init(&pool);
+	for (t = 0; t < thread_count; ++t)
+	{
+		workers[t].use_pool = 1;
+		workers[t].cache = pool_cache_init(&pool);
+		for (i = 0; i < live_count; ++i)
+		{
+			workers[t].live[i] = pool_cache_alloc(&main_cache);
+			assert("OOM" && workers[t].live[i]);
+			record_stamp(workers[t].live[i], make_stamp(t, i));
+		}
+	}
+	pool_cache_flush(&main_cache);
+	run_threads("pool_threads", workers, thread_count, &pool);
+	assert(pool.used == thread_count * live_count);
+
+	/* slots freed by a thread other than the one that allocated them */
+	for (t = 0; t < thread_count; ++t)
+	{
+		for (i = 0; i < live_count; ++i)
+		{
+			record_check(workers[t].live[i], make_stamp(t, i));
+			pool_cache_free(&main_cache, workers[t].live[i]);
+		}
+	}
+	pool_cache_flush(&main_cache);
+	assert(pool.used == 0);
+
+	printf("%zu threads, %zu live records of %zu bytes each\n", thread_count, live_count, sizeof(Record));
+
+	pool_destroy(&pool);
+	arena_release(&arena);
+	free(live);
+
+	return 0;
+}
@@ -0,0 +1,275 @@
+#include "bench.h"
+
+/*
+	worker threads building short lived temporaries, once from malloc and
+	once from their scratch arenas, then many threads appending records to
+	one arena, once behind a mutex and once through a SharedArena. checks
+	that nested scratch users never hand out the caller's arena and that no
+	two appended records overlap. prints ns per op.
+	usage: scratch [threads] [op_count]
+*/
+
+#define DEFAULT_OP_COUNT 2000000
+#define MAX_THREADS 64
+#define MAX_TEMP_SIZE 512
+#define MAX_RECORD_SIZE 48
+
+typedef struct {
+	size_t index;
+	size_t count;
+	uint64_t sum;
+
+	Arena *arena; /* locked append */
+	mutex_t *lock;
+	SharedArena *shared; /* lock-free append */
+	char **records;
+} Worker;
+
+static uint64_t
+temp_fill(unsigned char *temp, size_t size, uint64_t seed)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+	{
+		temp[i] = (unsigned char)(seed + i);
+	}
+	for (i = 0; i < size; i += 16)
+	{
+		sum += temp[i];
+	}
+
+	return sum;
+}
+
+/* builds its result in out with a temporary of its own, the way library code would */
+static char *
+join_digits(Arena *out, uint64_t x)
+{
+	ArenaSave scratch = scratch_begin(&out, 1);
+	char *digits, *result;
+	size_t len = 0, i;
+
+	assert(scratch.arena != out);
+	digits = arena_alloc_nozero(scratch.arena, 32);
+	do
+	{
+		digits[len++] = (char)('0' + x % 10);
+		x /= 10;
+	} while (x);
+
+	result = arena_alloc_nozero(out, len + 1);
+	for (i = 0; i < len; ++i)
+	{
+		result[i] = digits[len - 1 - i];
+	}
+	result[len] = 0;
+
+	scratch_end(scratch);
+
+	return result;
+}
+
+static void *
+temp_malloc(void *arg)
+{
+	Worker *worker = arg;
+	uint64_t rng = rng_seed(worker->index);
+	unsigned char *temp;
+	size_t i, size;
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		size = xorshift64(&rng) % MAX_TEMP_SIZE + 1;
+		temp = malloc(size);
+		assert("OOM" && temp);
+		worker->sum += temp_fill(temp, size, rng);
+		free(temp);
+	}
+
+	return NULL;
+}
+
+static void *
+temp_scratch(void *arg)
+{
+	Worker *worker = arg;
+	uint64_t rng = rng_seed(worker->index);
+	ArenaSave scratch;
+	unsigned char *temp;
+	size_t i, size;
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		size = xorshift64(&rng) % MAX_TEMP_SIZE + 1;
+		scratch = scratch_begin(NULL, 0);
+		temp = arena_alloc_nozero(scratch.arena, size);
+		worker->sum += temp_fill(temp, size, rng);
+		scratch_end(scratch);
+	}
+
+	/* the result in one scratch arena, the temporaries of join_digits in the other */
+	scratch = scratch_begin(NULL, 0);
+	assert(strcmp(join_digits(scratch.arena, 1234567890), "1234567890") == 0);
+	scratch_end(scratch);
+	assert(scratch.arena->current_offset == 0);
+
+	scratch_thread_release();
+
+	return NULL;
+}
+
+static size_t
+record_size(size_t index, size_t i)
+{
+	return 8 + (index * 7 + i * 13) % (MAX_RECORD_SIZE - 8);
+}
+
+static void *
+append_locked(void *arg)
+{
+	Worker *worker = arg;
+	size_t i, size;
+	char *record;
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		size = record_size(worker->index, i);
+		mutex_lock(worker->lock);
+		record = arena_alloc_nozero(worker->arena, size);
+		mutex_unlock(worker->lock);
+		assert("OOM" && record);
+		memset(record, (int)worker->index, size);
+	}
+
+	return NULL;
+}
+
+static void *
+append_shared(void *arg)
+{
+	Worker *worker = arg;
+	size_t i, size;
+	char *record;
+
+	for (i = 0; i < worker->count; ++i)
+	{
+		size = record_size(worker->index, i);
+		record = shared_arena_alloc_nozero(worker->shared, size);
+		assert("OOM" && record);
+		memset(record, (int)worker->index, size);
+		worker->records[i] = record;
+	}
+
+	return NULL;
+}
+
+static void
+run(const char *op, thread_fn fn, Worker *workers, size_t thread_count)
+{
+	thread_t threads[MAX_THREADS];
+	uint64_t start;
+	size_t t, ops = 0;
+
+	start = time_now_ns();
+	for (t = 0; t < thread_count; ++t)
+	{
+		if (!thread_create(&threads[t], fn, &workers[t]))
+		{
+			fprintf(stderr, "thread_create failed\n");
+			exit(1);
+		}
+	}
+	for (t = 0; t < thread_count; ++t)
+	{
+		thread_join(threads[t]);
+		ops += workers[t].count;
+	}
+
+	printf("%-14s %10.2f\n", op, (double)(time_now_ns() - start) / (double)ops);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t thread_count = argc > 1 ? (size_t)atoi(argv[1]) : thread_hw_count();
+	size_t count = argc > 2 ? (size_t)strtoull(argv[2], NULL, 10) : DEFAULT_OP_COUNT;
+	Worker workers[MAX_THREADS];
+	uint64_t malloc_sum = 0, scratch_sum = 0;
+	size_t t, i, j, size, buffer_size;
+	Arena arena;
+	SharedArena shared;
+	mutex_t lock;
+	char **records;
+
+	if (thread_count == 0 || thread_count > MAX_THREADS)
+	{
+		thread_count = MAX_THREADS;
+	}
+	count /= thread_count;
+
+	buffer_size = thread_count * count * MAX_RECORD_SIZE;
+	arena = arena_reserve(buffer_size + ARENA_COMMIT_GRANULARITY, 0);
+	records = malloc(thread_count * count * sizeof(char *));
+	assert("OOM" && arena.buffer && records);
+	mutex_init(&lock);
+
+	memset(workers, 0, sizeof(workers));
+	for (t = 0; t < thread_count; ++t)
+	{
+		workers[t].index = t;
+		workers[t].count = count;
+		workers[t].arena = &arena;
+		workers[t].lock = &lock;
+		workers[t].shared = &shared;
+		workers[t].records = &records[t * count];
+	}
+
+	printf("%-14s %10s\n", "op", "ns/op");
+
+	run("temp_malloc", temp_malloc, workers, thread_count);
+	for (t = 0; t < thread_count; ++t)
+	{
+		malloc_sum += workers[t].sum;
+		workers[t].sum = 0;
+	}
+	run("temp_scratch", temp_scratch, workers, thread_count);
+	for (t = 0; t < thread_count; ++t)
+	{
+		scratch_sum += workers[t].sum;
+	}
+	assert(malloc_sum == scratch_sum);
+
+	run("append_locked", append_locked, workers, thread_count);
+	assert(arena.current_offset <= buffer_size);
+	arena_reset(&arena);
+
+	/* the shared arena sits in committed memory taken from the reserved one */
+	shared = shared_arena_init(arena_alloc_nozero(&arena, buffer_size), buffer_size);
+	run("append_shared", append_shared, workers, thread_count);
+
+	/* every record still holds the bytes its own thread wrote */
+	for (t = 0; t < thread_count; ++t)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			size = record_size(t, i);
+			for (j = 0; j < size; ++j)
+			{
+				assert(workers[t].records[i][j] == (char)t);
+			}
+		}
+	}
+
+	printf("%zu threads, %zu shared bytes\n", thread_count, shared_arena_used(&shared));
+	shared_arena_reset(&shared);
+	assert(shared_arena_alloc(&shared, buffer_size + 1) == NULL);
+	assert(shared_arena_alloc(&shared, 1) == NULL);
+
+	mutex_destroy(&lock);
+	arena_release(&arena);
+	free(records);
+
+	return 0;
+}
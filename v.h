@@ -2,6 +2,7 @@
 #define V_H
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
@@ -16,27 +17,239 @@
 	#endif
 #endif
 
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
 /* BEGIN ARENA */
 
+/*
+	an arena either wraps a caller buffer (arena_init) or a range of address
+	space reserved with arena_reserve. a reserved arena commits memory in
+	ARENA_COMMIT_GRANULARITY steps as current_offset advances, so it never
+	moves, pointers into it stay valid, and only the touched part costs
+	physical memory. with ARENA_DECOMMIT_ON_RESET arena_reset hands the
+	committed pages back to the os.
+
+	zeroing is lazy: bytes past high_water have never been handed out and
+	read as zero, so arena_alloc only clears the part of a block below it,
+	and arena_reset clears nothing. a caller buffer starts with high_water at
+	buffer_size since its contents are unknown; a reserved arena starts at 0
+	and on reset gives pages of at least ARENA_MADVISE_THRESHOLD bytes back
+	to the kernel, which maps fresh zero pages on the next touch, so the
+	high water mark drops to 0 again. arena_alloc_nozero skips the clearing
+	for callers that overwrite the block anyway.
+
+	built with -DARENA_DEBUG every arena tracks its peak current_offset and
+	every allocation is counted against its __FILE__:__LINE__, arena_report
+	prints both. under AddressSanitizer that build also poisons what
+	arena_restore, arena_reset and a shrinking arena_resize_last give back,
+	so a pointer kept past its restore faults on the next touch instead of
+	reading whatever was allocated there since.
+*/
+
+#define ARENA_RESERVED 1
+#define ARENA_DECOMMIT_ON_RESET 2
+
+#ifndef ARENA_COMMIT_GRANULARITY
+#define ARENA_COMMIT_GRANULARITY (64 * 1024)
+#endif
+
+#ifndef ARENA_MADVISE_THRESHOLD
+#define ARENA_MADVISE_THRESHOLD (1024 * 1024)
+#endif
+
 typedef struct {
 	char *buffer;
 	size_t buffer_size;
 	size_t current_offset;
 	size_t previous_offset;
+	size_t committed; /* bytes from the start of buffer backed by memory, buffer_size for caller buffers */
+	size_t high_water; /* bytes past it read as zero */
+	int flags;
+#ifdef ARENA_DEBUG
+	size_t peak_offset; /* highest current_offset so far */
+#endif
 } Arena;
 
+#ifdef ARENA_DEBUG
+	#if defined(__has_feature)
+		#if __has_feature(address_sanitizer)
+			#define ARENA_ASAN 1
+		#endif
+	#endif
+	#if defined(__SANITIZE_ADDRESS__)
+		#define ARENA_ASAN 1
+	#endif
+
+	/* in ARENA DEBUG, below THREAD: the site table needs a lock */
+	static void arena_debug_record(Arena *arena, size_t size, const char *file, int line);
+	static void arena_debug_forget(char *buffer);
+	#define arena_debug_peak(arena) \
+		((arena)->peak_offset = (arena)->current_offset > (arena)->peak_offset ? (arena)->current_offset : (arena)->peak_offset)
+#else
+	#define arena_debug_forget(buffer) ((void)(buffer))
+	#define arena_debug_peak(arena) ((void)(arena))
+#endif
+
+#ifdef ARENA_ASAN
+	#include <sanitizer/asan_interface.h>
+	#define arena_poison(ptr, size) ASAN_POISON_MEMORY_REGION(ptr, size)
+	#define arena_unpoison(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+	#define arena_poison(ptr, size) ((void)(ptr), (void)(size))
+	#define arena_unpoison(ptr, size) ((void)(ptr), (void)(size))
+#endif
+
 Arena arena_init(char *buffer, size_t buffer_size) {
 	Arena arena;
 
 	memset(&arena, 0, sizeof(Arena));
-	memset(buffer, 0, buffer_size);
 
 	arena.buffer = buffer;
 	arena.buffer_size = buffer_size;
+	arena.committed = buffer_size;
+	arena.high_water = buffer_size;
+
+	/* the buffer may have belonged to an arena that poisoned it */
+	arena_unpoison(buffer, buffer_size);
+	arena_debug_forget(buffer);
 
 	return arena;
 }
 
+/* reserves reserve_size bytes of address space, buffer is NULL when that fails */
+Arena arena_reserve(size_t reserve_size, int flags) {
+	Arena arena;
+	void *ptr;
+
+	memset(&arena, 0, sizeof(Arena));
+	reserve_size = (reserve_size + ARENA_COMMIT_GRANULARITY - 1) / ARENA_COMMIT_GRANULARITY * ARENA_COMMIT_GRANULARITY;
+
+#ifdef _WIN32
+	ptr = VirtualAlloc(NULL, reserve_size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+	ptr = mmap(NULL, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (ptr == MAP_FAILED) {
+		ptr = NULL;
+	}
+#endif
+	if (ptr == NULL) {
+		return arena;
+	}
+
+	arena.buffer = ptr;
+	arena.buffer_size = reserve_size;
+	arena.flags = flags | ARENA_RESERVED;
+	arena_debug_forget(arena.buffer);
+
+	return arena;
+}
+
+/* releases the address space of a reserved arena, caller buffers are left alone */
+void arena_release(Arena *arena) {
+	if ((arena->flags & ARENA_RESERVED) && arena->buffer) {
+#ifdef ARENA_DEBUG
+		/* the next mapping at this address must not start out poisoned */
+		arena_unpoison(arena->buffer, arena->peak_offset);
+#endif
+#ifdef _WIN32
+		VirtualFree(arena->buffer, 0, MEM_RELEASE);
+#else
+		munmap(arena->buffer, arena->buffer_size);
+#endif
+	}
+	memset(arena, 0, sizeof(Arena));
+}
+
+/* makes sure the first end bytes of buffer are backed by memory, fresh pages read as zero */
+static int arena_commit(Arena *arena, size_t end) {
+	size_t committed;
+
+	if (end <= arena->committed) {
+		return 1;
+	}
+	if (!(arena->flags & ARENA_RESERVED) || end > arena->buffer_size) {
+		return 0;
+	}
+
+	committed = (end + ARENA_COMMIT_GRANULARITY - 1) / ARENA_COMMIT_GRANULARITY * ARENA_COMMIT_GRANULARITY;
+	if (committed > arena->buffer_size) {
+		committed = arena->buffer_size;
+	}
+
+#ifdef _WIN32
+	if (VirtualAlloc(arena->buffer + arena->committed, committed - arena->committed, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+		return 0;
+	}
+#else
+	if (mprotect(arena->buffer + arena->committed, committed - arena->committed, PROT_READ | PROT_WRITE) != 0) {
+		return 0;
+	}
+#endif
+	arena->committed = committed;
+
+	return 1;
+}
+
+/* returns every committed page of a reserved arena to the os */
+static void arena_decommit(Arena *arena) {
+	if (arena->committed == 0) {
+		return;
+	}
+#ifdef _WIN32
+	VirtualFree(arena->buffer, arena->committed, MEM_DECOMMIT);
+#else
+	/*
+		mapping fresh PROT_NONE pages over the range drops the old ones. when
+		that fails the pages stay mapped and committed, they are only emptied
+	*/
+	if (mmap(arena->buffer, arena->committed, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+		madvise(arena->buffer, arena->committed, MADV_DONTNEED);
+		arena->high_water = 0;
+		return;
+	}
+#endif
+	arena->committed = 0;
+	arena->high_water = 0;
+}
+
+/* gives the dirty pages of a reserved arena back, they read as zero on the next touch */
+static void arena_discard(Arena *arena) {
+	size_t size = (arena->high_water + ARENA_COMMIT_GRANULARITY - 1) / ARENA_COMMIT_GRANULARITY * ARENA_COMMIT_GRANULARITY;
+
+	if (size > arena->committed) {
+		size = arena->committed;
+	}
+#ifdef _WIN32
+	/* MEM_RESET does not promise zeroes, a decommit and commit does */
+	VirtualFree(arena->buffer, size, MEM_DECOMMIT);
+	if (VirtualAlloc(arena->buffer, size, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+		arena->committed = 0;
+	}
+#else
+	madvise(arena->buffer, size, MADV_DONTNEED);
+#endif
+	arena->high_water = 0;
+}
+
+/* clears [offset, offset + size) where it may be dirty and moves the high water mark past it */
+static void arena_zero(Arena *arena, size_t offset, size_t size, int zero) {
+	size_t end = offset + size;
+
+	if (zero && offset < arena->high_water) {
+		memset(arena->buffer + offset, 0, (end < arena->high_water ? end : arena->high_water) - offset);
+	}
+	if (end > arena->high_water) {
+		arena->high_water = end;
+	}
+}
+
 static uintptr_t align(uintptr_t addr, size_t alignment) {
 	uintptr_t aligned_addr;
 
@@ -49,7 +262,7 @@ static int is_power_of_two(size_t x) {
 	return (x & (x-1)) == 0;
 }
 
-void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
+static void *arena_push(Arena *arena, size_t size, size_t alignment, int zero) {
 	uintptr_t aligned_addr;
 	size_t aligned_offset;
 	void *ptr;
@@ -61,22 +274,57 @@ void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
 
 	aligned_offset = aligned_addr - (uintptr_t)arena->buffer;
 	
-	if (aligned_offset + size > arena->buffer_size) {
+	if (aligned_offset + size > arena->buffer_size || !arena_commit(arena, aligned_offset + size)) {
 		return NULL;
 	}
 
 	ptr = &arena->buffer[aligned_offset];
-	memset(ptr, 0, size);
+	arena_unpoison(ptr, size);
+	arena_zero(arena, aligned_offset, size, zero);
 
 	arena->previous_offset = aligned_offset;
 	arena->current_offset = aligned_offset + size;
+	arena_debug_peak(arena);
 
 	return ptr;
 }
 
+void *arena_alloc_aligned(Arena *arena, size_t size, size_t alignment) {
+	return arena_push(arena, size, alignment, 1);
+}
+
+/* the block holds whatever was there before */
+void *arena_alloc_aligned_nozero(Arena *arena, size_t size, size_t alignment) {
+	return arena_push(arena, size, alignment, 0);
+}
+
+#ifdef ARENA_DEBUG
+void *arena_alloc_aligned_at(Arena *arena, size_t size, size_t alignment, const char *file, int line) {
+	void *ptr = arena_push(arena, size, alignment, 1);
+
+	if (ptr) {
+		arena_debug_record(arena, size, file, line);
+	}
+	return ptr;
+}
+
+void *arena_alloc_aligned_nozero_at(Arena *arena, size_t size, size_t alignment, const char *file, int line) {
+	void *ptr = arena_push(arena, size, alignment, 0);
+
+	if (ptr) {
+		arena_debug_record(arena, size, file, line);
+	}
+	return ptr;
+}
+
+#define arena_alloc_aligned(arena, size, alignment) arena_alloc_aligned_at(arena, size, alignment, __FILE__, __LINE__)
+#define arena_alloc_aligned_nozero(arena, size, alignment) arena_alloc_aligned_nozero_at(arena, size, alignment, __FILE__, __LINE__)
+#endif
+
 #define ARENA_DEFAULT_ALIGNMENT sizeof(void *)
 
 #define arena_alloc(arena, size) arena_alloc_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT)
+#define arena_alloc_nozero(arena, size) arena_alloc_aligned_nozero(arena, size, ARENA_DEFAULT_ALIGNMENT)
 
 void *arena_resize_last(Arena *arena, size_t size) {
 	size_t last_allocation_size;
@@ -91,21 +339,38 @@ void *arena_resize_last(Arena *arena, size_t size) {
 		return ptr;
 	}
 
-	if (arena->previous_offset + size > arena->buffer_size) {
+	if (arena->previous_offset + size > arena->buffer_size || !arena_commit(arena, arena->previous_offset + size)) {
 		return NULL;
 	}
 
 	if (size > last_allocation_size) {
-		memset((void *)((uintptr_t)ptr + last_allocation_size), 0, size - last_allocation_size);
+		arena_unpoison(arena->buffer + arena->current_offset, size - last_allocation_size);
+		arena_zero(arena, arena->current_offset, size - last_allocation_size, 1);
 	} else {
-		memset((void *)((uintptr_t)ptr + size), 0, last_allocation_size - size);
+		arena_poison(arena->buffer + arena->previous_offset + size, last_allocation_size - size);
 	}
 
 	arena->current_offset = arena->previous_offset + size;
+	arena_debug_peak(arena);
+
+	return ptr;
+}
+
+#ifdef ARENA_DEBUG
+/* only growth is counted, against the site that resized */
+void *arena_resize_last_at(Arena *arena, size_t size, const char *file, int line) {
+	size_t last_allocation_size = arena->current_offset - arena->previous_offset;
+	void *ptr = arena_resize_last(arena, size);
 
+	if (ptr && size > last_allocation_size) {
+		arena_debug_record(arena, size - last_allocation_size, file, line);
+	}
 	return ptr;
 }
 
+#define arena_resize_last(arena, size) arena_resize_last_at(arena, size, __FILE__, __LINE__)
+#endif
+
 typedef struct {
 	Arena *arena;
 	size_t current_offset;
@@ -123,12 +388,21 @@ ArenaSave arena_save(Arena *arena) {
 }
 
 void arena_restore(Arena *arena, ArenaSave save) {
+	if (arena->current_offset > save.current_offset) {
+		arena_poison(arena->buffer + save.current_offset, arena->current_offset - save.current_offset);
+	}
 	arena->current_offset = save.current_offset;
 	arena->previous_offset = save.previous_offset;
 }
 
+/* O(1) unless pages go back to the os, later allocations clear what they reuse */
 void arena_reset(Arena *arena) {
-	memset(arena->buffer, 0, arena->buffer_size);
+	arena_poison(arena->buffer, arena->current_offset);
+	if (arena->flags & ARENA_DECOMMIT_ON_RESET) {
+		arena_decommit(arena);
+	} else if ((arena->flags & ARENA_RESERVED) && arena->high_water >= ARENA_MADVISE_THRESHOLD) {
+		arena_discard(arena);
+	}
 	arena->current_offset = arena->previous_offset = 0;
 }
 
@@ -158,6 +432,17 @@ String8 string8_create(const char *cstring, Arena *arena)
 	return str;
 }
 
+/* borrows cstring without copying it, the caller keeps it alive */
+String8 string8_borrow(const char *cstring)
+{
+	String8 str;
+
+	str.ptr = (char *)cstring;
+	str.len = strlen(cstring);
+
+	return str;
+}
+
 String8 read_entire_file(const char *path, Arena *arena) {
 	String8 content;
 	FILE *file;
@@ -230,6 +515,77 @@ const char *read_entire_file_cstring(const char *path, Arena *arena, size_t *out
 	return read_buffer;
 }
 
+/*
+	maps the whole file read-only, pages are only read in when touched.
+	returns an empty String8 on failure or for an empty file, release with file_unmap.
+*/
+String8 file_map_readonly(const char *path) {
+	String8 mapping;
+
+	memset(&mapping, 0, sizeof(String8));
+
+#ifdef _WIN32
+	HANDLE file, file_mapping;
+	LARGE_INTEGER file_size;
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		return mapping;
+	}
+
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return mapping;
+	}
+
+	file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (file_mapping == NULL) {
+		return mapping;
+	}
+
+	/* the view keeps the mapping alive */
+	mapping.ptr = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(file_mapping);
+	if (mapping.ptr) {
+		mapping.len = (size_t)file_size.QuadPart;
+	}
+#else
+	struct stat st;
+	void *ptr;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return mapping;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return mapping;
+	}
+
+	ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (ptr != MAP_FAILED) {
+		mapping.ptr = ptr;
+		mapping.len = (size_t)st.st_size;
+	}
+#endif
+
+	return mapping;
+}
+
+void file_unmap(String8 mapping) {
+	if (mapping.ptr == NULL) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(mapping.ptr);
+#else
+	munmap(mapping.ptr, mapping.len);
+#endif
+}
+
 /* END IO */
 
 /* BEGIN LOG */
@@ -325,6 +681,600 @@ logger_write(const char *tag, const char *file, const char *function, int line_n
 
 /* END LOG */
 
+/* BEGIN THREAD */
+
+/* mutex_t lives in LOG, which also pulls in windows.h / pthread.h */
+
+#ifdef _WIN32
+	typedef SRWLOCK rwlock_t;
+	#define RWLOCK_INITIALIZER SRWLOCK_INIT
+	#define rwlock_init(l) InitializeSRWLock(l)
+	#define rwlock_destroy(l) ((void)(l))
+	#define rwlock_rdlock(l) AcquireSRWLockShared(l)
+	#define rwlock_rdunlock(l) ReleaseSRWLockShared(l)
+	#define rwlock_wrlock(l) AcquireSRWLockExclusive(l)
+	#define rwlock_wrunlock(l) ReleaseSRWLockExclusive(l)
+	typedef HANDLE thread_t;
+#else
+	#include <unistd.h>
+	typedef pthread_rwlock_t rwlock_t;
+	#define RWLOCK_INITIALIZER PTHREAD_RWLOCK_INITIALIZER
+	#define rwlock_init(l) pthread_rwlock_init(l, NULL)
+	#define rwlock_destroy(l) pthread_rwlock_destroy(l)
+	#define rwlock_rdlock(l) pthread_rwlock_rdlock(l)
+	#define rwlock_rdunlock(l) pthread_rwlock_unlock(l)
+	#define rwlock_wrlock(l) pthread_rwlock_wrlock(l)
+	#define rwlock_wrunlock(l) pthread_rwlock_unlock(l)
+	typedef pthread_t thread_t;
+#endif
+
+typedef void *(*thread_fn)(void *arg);
+
+#ifdef _WIN32
+typedef struct {
+	thread_fn fn;
+	void *arg;
+} ThreadStart;
+
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+	ThreadStart start = *(ThreadStart *)param;
+	free(param);
+	start.fn(start.arg);
+	return 0;
+}
+#endif
+
+int thread_create(thread_t *thread, thread_fn fn, void *arg) {
+#ifdef _WIN32
+	ThreadStart *start = malloc(sizeof(ThreadStart));
+	if (start == NULL) {
+		return 0;
+	}
+	start->fn = fn;
+	start->arg = arg;
+	*thread = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+	if (*thread == NULL) {
+		free(start);
+		return 0;
+	}
+	return 1;
+#else
+	return pthread_create(thread, NULL, fn, arg) == 0;
+#endif
+}
+
+void thread_join(thread_t thread) {
+#ifdef _WIN32
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#else
+	pthread_join(thread, NULL);
+#endif
+}
+
+size_t thread_hw_count(void) {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+#if defined(_MSC_VER)
+	#define THREAD_LOCAL __declspec(thread)
+	#define atomic_add_size(p, n) ((size_t)InterlockedExchangeAddSizeT((p), (n)))
+	#define atomic_load_size(p) (*(volatile size_t *)(p))
+#else
+	#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+		#define THREAD_LOCAL _Thread_local
+	#else
+		#define THREAD_LOCAL __thread
+	#endif
+	/* returns the value before the add */
+	#define atomic_add_size(p, n) __atomic_fetch_add((p), (n), __ATOMIC_RELAXED)
+	#define atomic_load_size(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#endif
+
+/* END THREAD */
+
+/* BEGIN THREAD ARENAS */
+
+/*
+	scratch arenas: every thread owns SCRATCH_ARENA_COUNT reserved arenas,
+	set up on first use, for temporaries that die before the function that
+	made them returns. no locks and no malloc:
+
+		ArenaSave scratch = scratch_begin(&out, 1);
+		tmp = arena_alloc(scratch.arena, size);
+		...
+		scratch_end(scratch);
+
+	conflicts lists the arenas the caller is building its result in. when
+	that result lives in a scratch arena of its own caller, the one handed
+	out is a different scratch arena, so scratch_end never rolls back the
+	result. two arenas cover any chain of calls that passes one output arena
+	down. a thread that used scratch calls scratch_thread_release before it
+	exits, the address space is not given back otherwise.
+*/
+
+#ifndef SCRATCH_ARENA_COUNT
+#define SCRATCH_ARENA_COUNT 2
+#endif
+
+#ifndef SCRATCH_RESERVE_SIZE
+#define SCRATCH_RESERVE_SIZE (sizeof(void *) == 8 ? (size_t)1 << 30 : (size_t)1 << 26)
+#endif
+
+static THREAD_LOCAL Arena scratch_arenas[SCRATCH_ARENA_COUNT];
+
+ArenaSave scratch_begin(Arena **conflicts, size_t conflict_count) {
+	ArenaSave save;
+	Arena *arena;
+	size_t i, j;
+
+	for (i = 0; i < SCRATCH_ARENA_COUNT; ++i) {
+		arena = &scratch_arenas[i];
+		for (j = 0; j < conflict_count && conflicts[j] != arena; ++j) {
+		}
+		if (j < conflict_count) {
+			continue;
+		}
+
+		if (arena->buffer == NULL) {
+			*arena = arena_reserve(SCRATCH_RESERVE_SIZE, 0);
+			assert("OOM" && arena->buffer);
+		}
+		return arena_save(arena);
+	}
+
+	assert(!"every scratch arena is in conflicts");
+	memset(&save, 0, sizeof(save));
+	return save;
+}
+
+void scratch_end(ArenaSave scratch) {
+	arena_restore(scratch.arena, scratch);
+}
+
+void scratch_thread_release(void) {
+	size_t i;
+
+	for (i = 0; i < SCRATCH_ARENA_COUNT; ++i) {
+		arena_release(&scratch_arenas[i]);
+	}
+}
+
+/*
+	shared arena: any number of threads allocate from one buffer at the cost
+	of a single atomic add each, for many-writer append workloads. blocks
+	are never freed one by one, shared_arena_reset drops them all once no
+	thread allocates any more.
+
+	sizes are rounded up to ARENA_DEFAULT_ALIGNMENT so every offset stays
+	aligned without a compare-and-swap loop, larger alignments pay their
+	worst case padding. a failed allocation leaves current_offset past the
+	end, so every later one fails too. the buffer must be backed by memory
+	up front, committing pages as the offset grows would need a lock; for a
+	reserved arena take it with arena_alloc_nozero(&arena, size).
+*/
+
+typedef struct {
+	char *buffer;
+	size_t buffer_size;
+	size_t current_offset; /* only touched through atomic_add_size */
+} SharedArena;
+
+SharedArena shared_arena_init(char *buffer, size_t buffer_size) {
+	SharedArena arena;
+	uintptr_t start = align((uintptr_t)buffer, ARENA_DEFAULT_ALIGNMENT);
+
+	memset(&arena, 0, sizeof(SharedArena));
+	if (buffer_size < start - (uintptr_t)buffer) {
+		return arena;
+	}
+
+	arena.buffer = (char *)start;
+	arena.buffer_size = buffer_size - (start - (uintptr_t)buffer);
+
+	return arena;
+}
+
+static void *shared_arena_push(SharedArena *arena, size_t size, size_t alignment, int zero) {
+	size_t padding, offset;
+	uintptr_t addr;
+
+	assert(is_power_of_two(alignment));
+
+	padding = alignment > ARENA_DEFAULT_ALIGNMENT ? alignment - ARENA_DEFAULT_ALIGNMENT : 0;
+	size = (size_t)align(size, ARENA_DEFAULT_ALIGNMENT);
+
+	offset = atomic_add_size(&arena->current_offset, size + padding);
+	if (offset > arena->buffer_size || size + padding > arena->buffer_size - offset) {
+		return NULL;
+	}
+
+	addr = align((uintptr_t)arena->buffer + offset, alignment);
+	if (zero) {
+		memset((void *)addr, 0, size);
+	}
+
+	return (void *)addr;
+}
+
+void *shared_arena_alloc_aligned(SharedArena *arena, size_t size, size_t alignment) {
+	return shared_arena_push(arena, size, alignment, 1);
+}
+
+void *shared_arena_alloc_aligned_nozero(SharedArena *arena, size_t size, size_t alignment) {
+	return shared_arena_push(arena, size, alignment, 0);
+}
+
+#define shared_arena_alloc(arena, size) shared_arena_alloc_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT)
+#define shared_arena_alloc_nozero(arena, size) shared_arena_alloc_aligned_nozero(arena, size, ARENA_DEFAULT_ALIGNMENT)
+
+/* bytes handed out so far */
+size_t shared_arena_used(SharedArena *arena) {
+	size_t used = atomic_load_size(&arena->current_offset);
+
+	return used < arena->buffer_size ? used : arena->buffer_size;
+}
+
+/* no thread may be allocating */
+void shared_arena_reset(SharedArena *arena) {
+	arena->current_offset = 0;
+}
+
+/* END THREAD ARENAS */
+
+/* BEGIN POOL */
+
+/*
+	fixed size slots carved out of an Arena, for objects whose lifetimes do
+	not nest. a freed slot goes on an intrusive free list threaded through
+	its first bytes and the next alloc takes it back, both O(1); slots only
+	come from the arena when the list is empty, so the live objects stay
+	packed into the part of the arena the pool has touched. the memory goes
+	back with the arena, not with the pool.
+
+	pool_alloc and pool_free are for a pool one thread owns. threads sharing
+	a pool give each its own PoolCache: allocs and frees stay in the cache
+	and only every POOL_CACHE_BATCH of them takes the pool lock, to move a
+	batch of slots between the cache and the pool. slots may be freed into
+	any thread's cache. pool_cache_flush returns a cache's slots to the pool
+	and goes before the thread exits. with ARENA_DEBUG under AddressSanitizer
+	a free slot is poisoned past its free list link.
+*/
+
+#ifndef POOL_CACHE_BATCH
+#define POOL_CACHE_BATCH 32
+#endif
+
+typedef struct PoolSlot {
+	struct PoolSlot *next;
+} PoolSlot;
+
+typedef struct {
+	Arena *arena;
+	PoolSlot *free_list;
+	size_t slot_size;
+	size_t alignment;
+	size_t carved; /* slots taken from the arena */
+	size_t used; /* slots handed out or sitting in a cache */
+	mutex_t lock; /* only taken by PoolCache */
+} Pool;
+
+typedef struct {
+	Pool *pool;
+	PoolSlot *free_list;
+	size_t count;
+} PoolCache;
+
+/* in place, the lock must not be copied once initialized */
+void pool_init(Pool *pool, Arena *arena, size_t object_size, size_t alignment) {
+	assert(is_power_of_two(alignment));
+	memset(pool, 0, sizeof(Pool));
+
+	if (alignment < ARENA_DEFAULT_ALIGNMENT) {
+		alignment = ARENA_DEFAULT_ALIGNMENT;
+	}
+	if (object_size < sizeof(PoolSlot)) {
+		object_size = sizeof(PoolSlot);
+	}
+
+	pool->arena = arena;
+	pool->slot_size = (size_t)align(object_size, alignment);
+	pool->alignment = alignment;
+	mutex_init(&pool->lock);
+}
+
+void pool_destroy(Pool *pool) {
+	mutex_destroy(&pool->lock);
+	memset(pool, 0, sizeof(Pool));
+}
+
+static void *pool_take(Pool *pool) {
+	PoolSlot *slot = pool->free_list;
+
+	if (slot) {
+		pool->free_list = slot->next;
+	} else {
+		slot = arena_alloc_aligned_nozero(pool->arena, pool->slot_size, pool->alignment);
+		if (slot == NULL) {
+			return NULL;
+		}
+		pool->carved += 1;
+	}
+	pool->used += 1;
+	arena_unpoison(slot, pool->slot_size);
+
+	return slot;
+}
+
+void *pool_alloc(Pool *pool) {
+	void *ptr = pool_take(pool);
+
+	if (ptr) {
+		memset(ptr, 0, pool->slot_size);
+	}
+
+	return ptr;
+}
+
+/* the slot holds whatever its last owner left there */
+void *pool_alloc_nozero(Pool *pool) {
+	return pool_take(pool);
+}
+
+void pool_free(Pool *pool, void *ptr) {
+	PoolSlot *slot = ptr;
+
+	assert(ptr && pool->used);
+	arena_poison((char *)ptr + sizeof(PoolSlot), pool->slot_size - sizeof(PoolSlot));
+	slot->next = pool->free_list;
+	pool->free_list = slot;
+	pool->used -= 1;
+}
+
+PoolCache pool_cache_init(Pool *pool) {
+	PoolCache cache;
+
+	cache.pool = pool;
+	cache.free_list = NULL;
+	cache.count = 0;
+
+	return cache;
+}
+
+/* moves up to POOL_CACHE_BATCH slots from the pool into the cache */
+static void pool_cache_refill(PoolCache *cache) {
+	Pool *pool = cache->pool;
+	PoolSlot *slot;
+	char *block;
+	size_t i, n;
+
+	mutex_lock(&pool->lock);
+	while (cache->count < POOL_CACHE_BATCH && pool->free_list) {
+		slot = pool->free_list;
+		pool->free_list = slot->next;
+		slot->next = cache->free_list;
+		cache->free_list = slot;
+		cache->count += 1;
+		pool->used += 1;
+	}
+
+	/* the rest in one piece, the slots of one refill sit next to each other */
+	n = POOL_CACHE_BATCH - cache->count;
+	block = n ? arena_alloc_aligned_nozero(pool->arena, n * pool->slot_size, pool->alignment) : NULL;
+	for (i = 0; block && i < n; ++i) {
+		slot = (PoolSlot *)(block + (n - 1 - i) * pool->slot_size);
+		slot->next = cache->free_list;
+		cache->free_list = slot;
+	}
+	if (block) {
+		cache->count += n;
+		pool->carved += n;
+		pool->used += n;
+	}
+	mutex_unlock(&pool->lock);
+}
+
+/* moves all but keep slots of the cache back to the pool */
+static void pool_cache_drain(PoolCache *cache, size_t keep) {
+	Pool *pool = cache->pool;
+	PoolSlot *slot;
+
+	mutex_lock(&pool->lock);
+	while (cache->count > keep) {
+		slot = cache->free_list;
+		cache->free_list = slot->next;
+		slot->next = pool->free_list;
+		pool->free_list = slot;
+		cache->count -= 1;
+		pool->used -= 1;
+	}
+	mutex_unlock(&pool->lock);
+}
+
+static void *pool_cache_take(PoolCache *cache) {
+	PoolSlot *slot;
+
+	if (cache->count == 0) {
+		pool_cache_refill(cache);
+		if (cache->count == 0) {
+			return NULL;
+		}
+	}
+
+	slot = cache->free_list;
+	cache->free_list = slot->next;
+	cache->count -= 1;
+	arena_unpoison(slot, cache->pool->slot_size);
+
+	return slot;
+}
+
+void *pool_cache_alloc(PoolCache *cache) {
+	void *ptr = pool_cache_take(cache);
+
+	if (ptr) {
+		memset(ptr, 0, cache->pool->slot_size);
+	}
+
+	return ptr;
+}
+
+void *pool_cache_alloc_nozero(PoolCache *cache) {
+	return pool_cache_take(cache);
+}
+
+void pool_cache_free(PoolCache *cache, void *ptr) {
+	PoolSlot *slot = ptr;
+
+	assert(ptr);
+	arena_poison((char *)ptr + sizeof(PoolSlot), cache->pool->slot_size - sizeof(PoolSlot));
+	slot->next = cache->free_list;
+	cache->free_list = slot;
+	cache->count += 1;
+
+	/* hysteresis: a thread that frees what others allocate hands back a batch at a time */
+	if (cache->count >= 2 * POOL_CACHE_BATCH) {
+		pool_cache_drain(cache, POOL_CACHE_BATCH);
+	}
+}
+
+void pool_cache_flush(PoolCache *cache) {
+	if (cache->count) {
+		pool_cache_drain(cache, 0);
+	}
+}
+
+/* END POOL */
+
+/* BEGIN ARENA DEBUG */
+
+#ifdef ARENA_DEBUG
+
+/*
+	one record per arena and call site. arenas are passed around by value,
+	so an arena is known by its buffer; arena_init and arena_reserve start
+	the records of a buffer over. arena_resize_last counts what it grows a
+	block by as one more allocation at its own site. sites are told apart by the __FILE__
+	pointer, the same file compiled into two translation units shows twice.
+*/
+
+#ifndef ARENA_DEBUG_MAX_SITES
+#define ARENA_DEBUG_MAX_SITES 1024
+#endif
+
+typedef struct {
+	char *buffer;
+	const char *file;
+	int line;
+	size_t count;
+	size_t bytes;
+} ArenaSite;
+
+static rwlock_t arena_debug_lock = RWLOCK_INITIALIZER;
+
+static struct {
+	ArenaSite sites[ARENA_DEBUG_MAX_SITES];
+	size_t site_count;
+	size_t dropped; /* allocations from sites past ARENA_DEBUG_MAX_SITES */
+} arena_debug;
+
+static void arena_debug_record(Arena *arena, size_t size, const char *file, int line) {
+	uintptr_t h = ((uintptr_t)arena->buffer ^ (uintptr_t)file ^ (uintptr_t)line) * (uintptr_t)0x9e3779b97f4a7c15ULL;
+	size_t i = (size_t)(h >> (sizeof(uintptr_t) * 8 - 16)) % ARENA_DEBUG_MAX_SITES;
+	ArenaSite *site;
+
+	rwlock_wrlock(&arena_debug_lock);
+	for (;;) {
+		site = &arena_debug.sites[i];
+		if (site->file == NULL) {
+			if (arena_debug.site_count + 1 >= ARENA_DEBUG_MAX_SITES) {
+				arena_debug.dropped += 1;
+				break;
+			}
+			site->buffer = arena->buffer;
+			site->file = file;
+			site->line = line;
+			arena_debug.site_count += 1;
+		}
+		if (site->buffer == arena->buffer && site->file == file && site->line == line) {
+			site->count += 1;
+			site->bytes += size;
+			break;
+		}
+		i = (i + 1) % ARENA_DEBUG_MAX_SITES;
+	}
+	rwlock_wrunlock(&arena_debug_lock);
+}
+
+/* sites keep their slot so the probe chains stay intact, only the counts go */
+static void arena_debug_forget(char *buffer) {
+	size_t i;
+
+	rwlock_wrlock(&arena_debug_lock);
+	for (i = 0; i < ARENA_DEBUG_MAX_SITES; ++i) {
+		if (arena_debug.sites[i].buffer == buffer) {
+			arena_debug.sites[i].count = 0;
+			arena_debug.sites[i].bytes = 0;
+		}
+	}
+	rwlock_wrunlock(&arena_debug_lock);
+}
+
+static int arena_site_compare(const void *a, const void *b) {
+	const ArenaSite *x = a, *y = b;
+
+	return x->bytes < y->bytes ? 1 : x->bytes > y->bytes ? -1 : 0;
+}
+
+/*
+	peak and current use of arena, then its call sites by bytes allocated.
+	size a caller buffer from the peak; the bytes of a site add up every
+	allocation it made, including the ones restored away since.
+*/
+void arena_report(FILE *file, Arena *arena) {
+	ArenaSite *sites;
+	size_t i, n = 0;
+
+	fprintf(file, "arena %p: peak %zu of %zu bytes (%.1f%%), %zu in use, %zu committed\n",
+		(void *)arena->buffer,
+		arena->peak_offset, arena->buffer_size,
+		arena->buffer_size ? 100.0 * (double)arena->peak_offset / (double)arena->buffer_size : 0.0,
+		arena->current_offset, arena->committed);
+
+	sites = malloc(ARENA_DEBUG_MAX_SITES * sizeof(ArenaSite));
+	assert("OOM" && sites);
+
+	rwlock_rdlock(&arena_debug_lock);
+	for (i = 0; i < ARENA_DEBUG_MAX_SITES; ++i) {
+		if (arena_debug.sites[i].buffer == arena->buffer && arena_debug.sites[i].count) {
+			sites[n++] = arena_debug.sites[i];
+		}
+	}
+	if (arena_debug.dropped) {
+		fprintf(file, "  %zu allocations from sites past ARENA_DEBUG_MAX_SITES not counted\n", arena_debug.dropped);
+	}
+	rwlock_rdunlock(&arena_debug_lock);
+
+	qsort(sites, n, sizeof(ArenaSite), arena_site_compare);
+	for (i = 0; i < n; ++i) {
+		fprintf(file, "  %zu bytes in %zu allocations at %s:%d\n",
+			sites[i].bytes, sites[i].count, sites[i].file, sites[i].line);
+	}
+
+	free(sites);
+}
+
+#endif /* ARENA_DEBUG */
+
+/* END ARENA DEBUG */
+
 /* BEGIN SOCKET */
 
 #ifndef _WIN32
@@ -374,6 +1324,232 @@ int listen_tcp(const char *port, int backlog) {
 
 #endif
 
+/* BEGIN TIME */
+
+#ifdef _WIN32
+	/* windows.h is pulled in by LOG */
+#else
+	#include <time.h>
+#endif
+
+uint64_t time_now_ns(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+	if (frequency.QuadPart == 0) {
+		QueryPerformanceFrequency(&frequency);
+	}
+	QueryPerformanceCounter(&counter);
+
+	return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/* END TIME */
+
+/* BEGIN HASH */
+
+/*
+	64 bit hashes over arbitrary bytes, all taking a seed.
+	hash_wy is a wyhash (public domain) port reading 8 bytes at a time,
+	hash_aes absorbs 16 byte blocks with AES-NI rounds when compiled with
+	AES support (-maes / -march=native) and falls back to hash_wy otherwise.
+	hash_seed starts at 0, call hash_seed_random before building tables that
+	hold untrusted keys to make hash flooding impractical.
+*/
+
+static uint64_t hash_seed;
+
+#define HASH_P0 0xa0761d6478bd642fULL
+#define HASH_P1 0xe7037ed1a0b428dbULL
+#define HASH_P2 0x8ebc6af09c88c6e3ULL
+#define HASH_P3 0x589965cc75374cc3ULL
+
+static void hash_mul128(uint64_t *a, uint64_t *b) {
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	*a = _umul128(*a, *b, b);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl, lo, hi;
+	lo = t + (rm1 << 32);
+	c += lo < t;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+static uint64_t hash_mix(uint64_t a, uint64_t b) {
+	hash_mul128(&a, &b);
+	return a ^ b;
+}
+
+static uint64_t hash_read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static uint64_t hash_read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+uint64_t hash_fnv1a(const void *key, size_t len, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t hash = 0xcbf29ce484222325ULL ^ seed;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t hash_wy(const void *key, size_t len, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t a, b, see1, see2;
+	size_t i;
+
+	seed ^= hash_mix(seed ^ HASH_P0, HASH_P1);
+
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (hash_read32(p) << 32) | hash_read32(p + ((len >> 3) << 2));
+			b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		i = len;
+		if (i > 48) {
+			see1 = see2 = seed;
+			do {
+				seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+				see1 = hash_mix(hash_read64(p + 16) ^ HASH_P2, hash_read64(p + 24) ^ see1);
+				see2 = hash_mix(hash_read64(p + 32) ^ HASH_P3, hash_read64(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = hash_mix(hash_read64(p) ^ HASH_P1, hash_read64(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = hash_read64(p + i - 16);
+		b = hash_read64(p + i - 8);
+	}
+
+	a ^= HASH_P1;
+	b ^= seed;
+	hash_mul128(&a, &b);
+
+	return hash_mix(a ^ HASH_P0 ^ len, b ^ HASH_P1);
+}
+
+#if defined(__AES__)
+#include <wmmintrin.h>
+#define HASH_HAS_AES 1
+
+uint64_t hash_aes(const void *key, size_t len, uint64_t seed) {
+	const unsigned char *p = (const unsigned char *)key;
+	__m128i k = _mm_set_epi64x((long long)(seed ^ HASH_P0), (long long)(seed ^ HASH_P1));
+	__m128i s0 = _mm_xor_si128(k, _mm_set_epi64x(0, (long long)len));
+	__m128i s1, s2, s3;
+	uint64_t a, b;
+	size_t i = len;
+
+	if (len < 16) {
+		/* same overlapping short-key reads as hash_wy, no byte loop */
+		if (len >= 4) {
+			a = (hash_read32(p) << 32) | hash_read32(p + ((len >> 3) << 2));
+			b = (hash_read32(p + len - 4) << 32) | hash_read32(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+		s0 = _mm_aesenc_si128(s0, _mm_set_epi64x((long long)b, (long long)a));
+	} else {
+		if (i >= 64) {
+			/* four independent lanes hide the aesenc latency on long keys */
+			s1 = _mm_xor_si128(k, _mm_set_epi64x((long long)HASH_P2, 0));
+			s2 = _mm_xor_si128(k, _mm_set_epi64x(0, (long long)HASH_P3));
+			s3 = _mm_xor_si128(k, _mm_set_epi64x((long long)HASH_P3, (long long)HASH_P2));
+			do {
+				s0 = _mm_aesenc_si128(s0, _mm_loadu_si128((__m128i *)p));
+				s1 = _mm_aesenc_si128(s1, _mm_loadu_si128((__m128i *)(p + 16)));
+				s2 = _mm_aesenc_si128(s2, _mm_loadu_si128((__m128i *)(p + 32)));
+				s3 = _mm_aesenc_si128(s3, _mm_loadu_si128((__m128i *)(p + 48)));
+				p += 64;
+				i -= 64;
+			} while (i >= 64);
+			s0 = _mm_aesenc_si128(s0, s2);
+			s1 = _mm_aesenc_si128(s1, s3);
+			s0 = _mm_aesenc_si128(s0, s1);
+		}
+		while (i > 16) {
+			s0 = _mm_aesenc_si128(s0, _mm_loadu_si128((__m128i *)p));
+			p += 16;
+			i -= 16;
+		}
+		/* last block overlaps the previous one instead of being zero padded */
+		s0 = _mm_aesenc_si128(s0, _mm_loadu_si128((__m128i *)(p + i - 16)));
+	}
+
+	s0 = _mm_aesenc_si128(s0, k);
+	s0 = _mm_aesenc_si128(s0, k);
+	s0 = _mm_aesenclast_si128(s0, k);
+
+	return (uint64_t)_mm_cvtsi128_si64(s0) ^ (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(s0, s0));
+}
+#else
+#define HASH_HAS_AES 0
+
+uint64_t hash_aes(const void *key, size_t len, uint64_t seed) {
+	return hash_wy(key, len, seed);
+}
+#endif
+
+/* seeds from the os rng when there is one, from time and aslr otherwise */
+void hash_seed_random(void) {
+	uint64_t seed = 0;
+	FILE *file;
+
+	if ((file = fopen("/dev/urandom", "rb")) != NULL) {
+		if (fread(&seed, sizeof(seed), 1, file) != 1) {
+			seed = 0;
+		}
+		fclose(file);
+	}
+
+	seed ^= hash_mix(time_now_ns() ^ HASH_P2, (uint64_t)(uintptr_t)&seed ^ HASH_P3);
+	hash_seed = seed;
+}
+
+/* END HASH */
+
 /* BEGIN FORMATTERS */
 
 typedef struct {
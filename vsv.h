@@ -0,0 +1,211 @@
+#ifndef VSV_H
+#define VSV_H
+
+#include "v.h"
+
+/*
+	memory layout is a sequence of [SSSS|[VVV...VVV]
+								   [-^^-][---^^^---]
+								    size    value
+
+	the size prefix is either reserved_size_bytes wide (little endian) or,
+	with reserved_size_bytes == VSV_SIZE_VARINT, a LEB128 varint: 7 bits per
+	byte, low groups first, high bit set on every byte but the last, so
+	values under 128 bytes pay a single byte.
+
+	with index_stride k > 0 the buffer also keeps the offset of every k-th
+	record, and vsv_get_nth walks at most k - 1 records from the nearest
+	one. k == 1 makes it O(1) at sizeof(size_t) per record. sequential
+	scans should use vsv_iter / vsv_next, which need no index.
+*/
+
+#define VSV_SIZE_VARINT 0
+#define VSV_VARINT_MAX_BYTES 10
+
+typedef struct {
+	char *ptr;
+	size_t reserved_size_bytes; /* num bytes reserved to represent the size of the following value, or VSV_SIZE_VARINT */
+	size_t size;
+	size_t capacity;
+	size_t count; /* number of values */
+
+	size_t index_stride; /* 0 for no index */
+	size_t *index; /* offset of values 0, k, 2k... */
+	size_t index_capacity;
+} VSV_Buffer; /* variable sized values buffer */
+
+typedef struct {
+	VSV_Buffer *vsv;
+	size_t offset;
+} VSV_Iterator;
+
+VSV_Buffer vsv_create(size_t initial_capacity, size_t reserved_size_bytes, size_t index_stride) {
+	VSV_Buffer vsv;
+	assert(initial_capacity && reserved_size_bytes <= sizeof(size_t));
+	memset(&vsv, 0, sizeof(vsv));
+	vsv.ptr = malloc(initial_capacity);
+	assert("OOM" && vsv.ptr);
+	vsv.capacity = initial_capacity;
+	vsv.reserved_size_bytes = reserved_size_bytes;
+	vsv.index_stride = index_stride;
+	return vsv;
+}
+
+void vsv_destroy(VSV_Buffer *vsv) {
+	assert(vsv && vsv->capacity && vsv->ptr);
+	free(vsv->ptr);
+	if (vsv->index) {
+		free(vsv->index);
+	}
+	memset(vsv, 0, sizeof(*vsv));
+}
+
+void vsv_ensure_value_size_within_reserved_size_bytes(VSV_Buffer *vsv, size_t value_size) {
+	if (vsv->reserved_size_bytes != VSV_SIZE_VARINT && vsv->reserved_size_bytes < sizeof(size_t)) {
+		assert( value_size < ((size_t)1 << (8 * vsv->reserved_size_bytes)) );
+	}
+}
+
+/* writes the size prefix of value_size to out (NULL to only measure it), returns its length */
+static size_t vsv_write_size(VSV_Buffer *vsv, char *out, size_t value_size) {
+	unsigned char byte;
+	size_t n = 0;
+
+	if (vsv->reserved_size_bytes != VSV_SIZE_VARINT) {
+		if (out) {
+			memcpy(out, &value_size, vsv->reserved_size_bytes);
+		}
+		return vsv->reserved_size_bytes;
+	}
+
+	do {
+		byte = value_size & 0x7f;
+		value_size >>= 7;
+		if (value_size) {
+			byte |= 0x80;
+		}
+		if (out) {
+			out[n] = (char)byte;
+		}
+		n += 1;
+	} while (value_size);
+
+	return n;
+}
+
+/* reads the size prefix at offset, returns its length or 0 when it runs past the end */
+static size_t vsv_read_size(VSV_Buffer *vsv, size_t offset, size_t *out_value_size) {
+	unsigned char byte;
+	size_t n = 0;
+
+	*out_value_size = 0;
+
+	if (vsv->reserved_size_bytes != VSV_SIZE_VARINT) {
+		if (offset + vsv->reserved_size_bytes > vsv->size) {
+			return 0;
+		}
+		memcpy(out_value_size, vsv->ptr + offset, vsv->reserved_size_bytes);
+		return vsv->reserved_size_bytes;
+	}
+
+	do {
+		if (offset + n >= vsv->size || n == VSV_VARINT_MAX_BYTES) {
+			return 0;
+		}
+		byte = (unsigned char)vsv->ptr[offset + n];
+		*out_value_size |= (size_t)(byte & 0x7f) << (7 * n);
+		n += 1;
+	} while (byte & 0x80);
+
+	return n;
+}
+
+void vsv_push(VSV_Buffer *vsv, void *value, size_t value_size) {
+	size_t allocation_size, prefix_size;
+	vsv_ensure_value_size_within_reserved_size_bytes(vsv, value_size);
+
+	prefix_size = vsv_write_size(vsv, NULL, value_size);
+	allocation_size = prefix_size + value_size;
+	while (vsv->size + allocation_size > vsv->capacity) {
+		vsv->capacity *= 2;
+		vsv->ptr = realloc(vsv->ptr, vsv->capacity);
+		assert("OOM" && vsv->ptr);
+	}
+
+	if (vsv->index_stride && vsv->count % vsv->index_stride == 0) {
+		if (vsv->count / vsv->index_stride == vsv->index_capacity) {
+			vsv->index_capacity = vsv->index_capacity ? vsv->index_capacity * 2 : 16;
+			vsv->index = realloc(vsv->index, vsv->index_capacity * sizeof(size_t));
+			assert("OOM" && vsv->index);
+		}
+		vsv->index[vsv->count / vsv->index_stride] = vsv->size;
+	}
+
+	vsv_write_size(vsv, (char *)vsv->ptr + vsv->size, value_size);
+
+	memcpy((char *)vsv->ptr + vsv->size + prefix_size,
+			value,
+			value_size);
+
+	vsv->size += allocation_size;
+	vsv->count += 1;
+}
+
+VSV_Iterator vsv_iter(VSV_Buffer *vsv) {
+	VSV_Iterator it;
+	it.vsv = vsv;
+	it.offset = 0;
+	return it;
+}
+
+/* returns 0 past the last value, the value stays valid until the next push */
+int vsv_next(VSV_Iterator *it, void **out_value, size_t *out_value_size) {
+	size_t value_size, prefix_size;
+
+	if (it->offset >= it->vsv->size) {
+		return 0;
+	}
+
+	prefix_size = vsv_read_size(it->vsv, it->offset, &value_size);
+	assert(prefix_size && it->offset + prefix_size + value_size <= it->vsv->size);
+
+	if (out_value) {
+		*out_value = (char *)it->vsv->ptr + it->offset + prefix_size;
+	}
+	if (out_value_size) {
+		*out_value_size = value_size;
+	}
+	it->offset += prefix_size + value_size;
+
+	return 1;
+}
+
+size_t vsv_get_nth(VSV_Buffer *vsv, size_t n, void **out_value) {
+	VSV_Iterator it = vsv_iter(vsv);
+	size_t current_size, i = 0;
+	void *value;
+
+	if (n >= vsv->count) {
+		if (out_value) {
+			*out_value = NULL;
+		}
+		return 0;
+	}
+
+	if (vsv->index_stride) {
+		it.offset = vsv->index[n / vsv->index_stride];
+		i = n / vsv->index_stride * vsv->index_stride;
+	}
+
+	for (; i <= n; ++i) {
+		vsv_next(&it, &value, &current_size);
+	}
+
+	if (out_value) {
+		*out_value = value;
+	}
+
+	return current_size;
+}
+
+#endif /* VSV_H */